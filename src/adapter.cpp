@@ -1,25 +1,194 @@
 // Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
 
+#include <csignal>
+#include <cstdlib>
+#include <functional>
 #include <string>
+#include <thread>
+
+#include <boost/asio/signal_set.hpp>
 
 #include "spdlog/spdlog.h"
 
 #include "adapter_core.hpp"
+#include "adapter_host.hpp"
+#include "logging.hpp"
 #include "broker_connection.hpp"
+#include "env.hpp"
 #include "handler.hpp"
+#include "session_recorder.hpp"
 #include "smartdoor_handler.hpp"
+#include "smartdoor_pool_handler.hpp"
+#include "stimulus_generator.hpp"
+#include "stimulus_pacer.hpp"
+#include "text_protocol_handler.hpp"
+#include "worker_pool.hpp"
+
+// Call dump whenever the process receives SIGUSR1 (kill -USR1 <pid>).
+void dump_on_signal(boost::asio::signal_set* signals_ptr, std::function<void()> dump) {
+    signals_ptr->async_wait(
+        [signals_ptr, dump](const boost::system::error_code& ec, int signal_number) {
+            if (ec) {
+                return;
+            }
+            dump();
+            dump_on_signal(signals_ptr, dump);
+        });
+}
+
+// If ADAPTER_PROTOCOL_SPEC is set, the labels and the wire format of the SUT
+// are read from that spec file instead of being those of the SmartDoor.
+// If ADAPTER_SUT_URLS is set, the adapter tests a pool of SmartDoor replicas
+// at those urls (see smartdoor_pool_handler.hpp).
+Handler* create_handler(boost::asio::io_service* io_service_ptr) {
+    const char* spec_file = std::getenv("ADAPTER_PROTOCOL_SPEC");
+    const char* sut_urls = std::getenv("ADAPTER_SUT_URLS");
+    bool pool = sut_urls != 0 && *sut_urls != 0;
+    if (spec_file == 0 || *spec_file == 0) {
+        if (pool) {
+            return new SmartDoorPoolHandler(sut_urls, io_service_ptr);
+        }
+        return new SmartDoorHandler(SMARTDOOR_URL, io_service_ptr);
+    }
+    if (pool) {
+        spdlog::error("A pool of SUTs cannot be used with a protocol spec");
+        exit(1);
+    }
+
+    TextProtocolHandler* handler_ptr =
+        new TextProtocolHandler(spec_file, SMARTDOOR_URL, io_service_ptr);
+    if (!handler_ptr->is_loaded()) {
+        spdlog::error("Cannot use the protocol spec: " + std::string(spec_file));
+        exit(1);
+    }
+    return handler_ptr;
+}
 
-void run_test(std::string name, std::string url, std::string token) {
-    BrokerConnection broker_connection(url, token);
-    Handler* handler_ptr = new SmartDoorHandler();
+// Both the connection to AMP and the connection to the SUT run on the
+// io_service of the WorkerPool, with n_threads threads. With a single thread,
+// both legs share one event loop and no messages are handed over between threads.
+// The events of both connections are processed in order on the AdapterCore's
+// WorkQueue, also when there are several threads.
+//
+// If ADAPTER_RECORD is set, all messages of the session are recorded in that
+// file, which is ADAPTER_RECORD_SIZE_MB megabytes at most (default: 256).
+void run_test(std::string name, std::string url, std::string token, size_t n_threads) {
+    WorkerPool worker_pool(n_threads);
+    BrokerConnection broker_connection(url, token, &worker_pool.get_io_service());
+    Handler* handler_ptr = create_handler(&worker_pool.get_io_service());
     AdapterCore adapter_core(name, &broker_connection, handler_ptr);
+    StimulusPacer pacer(&worker_pool.get_io_service());
 
     broker_connection.register_adapter_core(&adapter_core);
     handler_ptr -> register_adapter_core(&adapter_core);
+    adapter_core.register_work_queue(worker_pool.create_queue());
+    adapter_core.register_pacer(&pacer);
+
+    SessionRecorder* recorder_ptr = 0;
+    const char* record_file = std::getenv("ADAPTER_RECORD");
+    if (record_file != 0 && *record_file != 0) {
+        long megabytes = axini::env_long("ADAPTER_RECORD_SIZE_MB", 256);
+        size_t size = (size_t) (megabytes > 0 ? megabytes : 256) << 20;
+        recorder_ptr = new SessionRecorder(record_file, size);
+        if (recorder_ptr->is_open()) {
+            spdlog::info("Recording the session in: " + std::string(record_file));
+            adapter_core.register_recorder(recorder_ptr);
+        }
+    }
+
+    // The dump reads the state of the AdapterCore and the handler: it is
+    // processed on the WorkQueue of the AdapterCore, like all other events.
+    boost::asio::signal_set signals(worker_pool.get_io_service(), SIGUSR1);
+    dump_on_signal(&signals, std::bind(&AdapterCore::dispatch, &adapter_core,
+        std::function<void()>(std::bind(&AdapterCore::dump_latencies, &adapter_core))));
+
+    worker_pool.run();
     adapter_core.start();
 
-    // Wait for the thread of the BrokerConnection to be terminated (which is never).
-    broker_connection.get_thread()->join();
+    // Wait for the threads of the WorkerPool to be terminated (which is never).
+    worker_pool.join();
+    delete recorder_ptr;
+}
+
+// Run all sessions listed in the file in a single process, on a pool of
+// n_workers threads.
+void run_host(std::string filename, size_t n_workers) {
+    std::vector<SessionSpec> specs = AdapterHost::read_sessions(filename);
+    if (specs.empty()) {
+        spdlog::error("No sessions found in " + filename);
+        exit(1);
+    }
+
+    AdapterHost host(n_workers);
+    for (SessionSpec& spec : specs) {
+        host.add_session(spec);
+    }
+
+    boost::asio::signal_set signals(host.get_io_service(), SIGUSR1);
+    dump_on_signal(&signals, std::bind(&AdapterHost::dump_latencies, &host));
+
+    host.run();
+}
+
+// Generate stimuli for the SUT without AMP, see stimulus_generator.hpp. The
+// AdapterCore, the handler and the generator share a single event loop.
+void run_generator(const GeneratorOptions& options) {
+    boost::asio::io_service io_service;
+    Handler* handler_ptr = create_handler(&io_service);
+    AdapterCore adapter_core("generator", 0, handler_ptr);
+    StimulusPacer pacer(&io_service);
+    handler_ptr->register_adapter_core(&adapter_core);
+    adapter_core.register_pacer(&pacer);
+
+    StimulusGenerator generator(&io_service, &adapter_core, handler_ptr, options);
+    adapter_core.register_observer(&generator);
+    io_service.post(std::bind(&StimulusGenerator::start, &generator));
+    io_service.run();
+
+    adapter_core.dump_latencies();
+    delete handler_ptr;
+}
+
+// adapter --generate [<sut url>] [--rate <n>] [--concurrency <n>]
+//                    [--duration <s>] [--bad-weather <fraction>]
+//                    [--interval <s>] [--seed <n>]
+bool parse_generator_options(int argc, char* argv[], GeneratorOptions* options_ptr) {
+    options_ptr->sut_url     = SMARTDOOR_URL;
+    options_ptr->rate        = 0;
+    options_ptr->concurrency = 1;
+    options_ptr->duration    = 10;
+    options_ptr->bad_weather = 0;
+    options_ptr->interval    = 1;
+    options_ptr->seed        = 1;
+
+    int i = 2;
+    if (i < argc && argv[i][0] != '-') {
+        options_ptr->sut_url = argv[i++];
+    }
+    for (; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        const char* value = argv[i + 1];
+        if (option == "--rate") {
+            options_ptr->rate = std::atof(value);
+        } else if (option == "--concurrency") {
+            options_ptr->concurrency = std::atol(value);
+        } else if (option == "--duration") {
+            options_ptr->duration = std::atof(value);
+        } else if (option == "--bad-weather") {
+            options_ptr->bad_weather = std::atof(value);
+        } else if (option == "--interval") {
+            options_ptr->interval = std::atof(value);
+        } else if (option == "--seed") {
+            options_ptr->seed = std::strtoul(value, 0, 10);
+        } else {
+            return false;
+        }
+    }
+    // In rate mode, the concurrency only limits the outstanding stimuli.
+    if (options_ptr->rate > 0 && options_ptr->concurrency == 1) {
+        options_ptr->concurrency = 1000;
+    }
+    return i == argc && options_ptr->concurrency > 0 && options_ptr->interval > 0;
 }
 
 // The adapter should connect to a server running AMP, announce itself with a name, and
@@ -30,23 +199,86 @@ const std::string ADAPTER_NAME = "smartdoor-adapter-cpp@machine-name";
 const std::string URL = "wss://course02.axini.com:443/adapters";
 const std::string TOKEN = "adapter token from AMP's adapter page";
 
+void usage() {
+    std::cout << "usage: adapter <name> <url> <token> [<threads>]" << std::endl
+              << "       adapter --sessions <file> [<workers>]" << std::endl
+              << "       adapter --generate [<sut url>] [--rate <n>] [--concurrency <n>]"
+              << " [--duration <s>]" << std::endl
+              << "               [--bad-weather <fraction>] [--interval <s>] [--seed <n>]"
+              << std::endl;
+    exit(1);
+}
+
+// A number of threads or workers: a positive number, or 0 if the value is
+// not one.
+size_t parse_thread_count(const char* value) {
+    char* end = 0;
+    unsigned long count = std::strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || value[0] == '-') {
+        return 0;
+    }
+    return count;
+}
+
 int main(int argc, char* argv[]) {
     std::string name  = ADAPTER_NAME;
     std::string url   = URL;
     std::string token = TOKEN;
+    size_t n_threads  = 1;
 
-    if (argc == 4) {
+    // Logging the message path would be the generator's bottleneck.
+    if (argc >= 2 && std::string(argv[1]) == "--generate") {
+        setenv("SPDLOG_LEVEL", "warn", 0);
+    }
+    axini::init_logging_from_env();
+
+    if (argc >= 3 && argc <= 4 && std::string(argv[1]) == "--sessions") {
+        size_t n_workers = std::thread::hardware_concurrency();
+        if (argc == 4) {
+            n_workers = parse_thread_count(argv[3]);
+            if (n_workers == 0) {
+                usage();
+            }
+        }
+        spdlog::info("Starting adapter host with sessions from: " + std::string(argv[2]));
+        run_host(argv[2], n_workers);
+        google::protobuf::ShutdownProtobufLibrary();
+        spdlog::shutdown();
+        return 0;
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--generate") {
+        GeneratorOptions generator_options;
+        if (!parse_generator_options(argc, argv, &generator_options)) {
+            usage();
+        }
+        spdlog::info("Generating stimuli for the SUT @ " + generator_options.sut_url);
+        run_generator(generator_options);
+        google::protobuf::ShutdownProtobufLibrary();
+        spdlog::shutdown();
+        return 0;
+    }
+
+    if (argc == 4 || argc == 5) {
         name  = argv[1];
         url   = argv[2];
         token = argv[3];
+        if (argc == 5) {
+            n_threads = parse_thread_count(argv[4]);
+            if (n_threads == 0) {
+                usage();
+            }
+        }
     } else if (argc != 1) {
-        std::cout << "usage: adapter <name> <url> <token>" << std::endl;
-        exit(1);
+        usage();
     }
 
     spdlog::info("Starting adapter: " + ADAPTER_NAME);
-    run_test(name, url, token);
+    run_test(name, url, token, n_threads);
 
     // Delete all global objects allocated by libprotobuf.
     google::protobuf::ShutdownProtobufLibrary();
+
+    // Flush the asynchronous logger.
+    spdlog::shutdown();
 }
@@ -1,17 +1,48 @@
 // Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
 
+#include <google/protobuf/util/message_differencer.h>
+
 #include "spdlog/spdlog.h"
+#include "logging.hpp"
 
 #include "adapter_core.hpp"
 #include "broker_connection.hpp"
 #include "axini_protobuf.hpp"
-
+#include "clock.hpp"
+#include "env.hpp"
+#include "session_recorder.hpp"
+#include "stimulus_pacer.hpp"
+#include "worker_pool.hpp"
+
+// The reconnect delays, whether to keep the connection with the SUT and
+// whether to pre-connect to the SUT can be set with the environment variables
+// ADAPTER_RECONNECT_MIN_MS, ADAPTER_RECONNECT_MAX_MS,
+// ADAPTER_KEEP_SUT_CONNECTION and ADAPTER_PRECONNECT_SUT.
 AdapterCore::AdapterCore(std::string name, BrokerConnection* broker_connection_ptr,
-                         Handler* handler_ptr) {
+                         Handler* handler_ptr)
+    : reconnect_scheduler(axini::env_long("ADAPTER_RECONNECT_MIN_MS", 100),
+                          axini::env_long("ADAPTER_RECONNECT_MAX_MS", 30000)) {
     this->adapter_name = name;
     this->broker_connection_ptr = broker_connection_ptr;
     this->handler_ptr = handler_ptr;
+    this->work_queue_ptr = 0;
+    this->recorder_ptr = 0;
+    this->observer_ptr = 0;
+    this->pacer_ptr = 0;
+    this->announcement_version = 0;
     this->state = DISCONNECTED;
+    this->keep_sut_connection = axini::env_long("ADAPTER_KEEP_SUT_CONNECTION", 0) != 0;
+    this->preconnect = axini::env_long("ADAPTER_PRECONNECT_SUT", 1) != 0;
+    this->preconnected = false;
+    this->preconnect_ready = false;
+    this->configuration_time = 0;
+    this->amp_backlog = false;
+    this->sut_backlog = false;
+
+    for (const Label& label : handler_ptr->get_supported_labels()) {
+        latencies.add_label(label.label());
+    }
+    latencies.add_label(SESSION_LATENCIES);
 }
 
 AdapterCore::~AdapterCore() {
@@ -19,11 +50,60 @@ AdapterCore::~AdapterCore() {
     // not "own" the Handler, so we should *not* delete them.
 }
 
+// The events from the BrokerConnection and from the Handler's connection are
+// processed on the WorkQueue. The AdapterCore does not "own" the WorkQueue.
+void AdapterCore::register_work_queue(WorkQueue* work_queue_ptr) {
+    this->work_queue_ptr = work_queue_ptr;
+}
+
+// Without a WorkQueue (e.g. in benchmarks) events are processed right away,
+// on the calling thread.
+// The AdapterCore does not "own" the SessionRecorder.
+void AdapterCore::register_recorder(SessionRecorder* recorder_ptr) {
+    this->recorder_ptr = recorder_ptr;
+    handler_ptr->register_recorder(recorder_ptr);
+}
+
+// The AdapterCore does not "own" the AdapterObserver.
+void AdapterCore::register_observer(AdapterObserver* observer_ptr) {
+    this->observer_ptr = observer_ptr;
+}
+
+// The AdapterCore does not "own" the StimulusPacer.
+void AdapterCore::register_pacer(StimulusPacer* pacer_ptr) {
+    this->pacer_ptr = pacer_ptr;
+    pacer_ptr->register_adapter_core(this);
+}
+
+void AdapterCore::dispatch(std::function<void()> event) {
+    if (work_queue_ptr != 0) {
+        work_queue_ptr->post(event);
+    } else {
+        event();
+    }
+}
+
+void AdapterCore::set_keep_sut_connection(bool keep) {
+    keep_sut_connection = keep;
+}
+
+void AdapterCore::set_preconnect_sut(bool preconnect) {
+    this->preconnect = preconnect;
+}
+
+const LatencyHistogram& AdapterCore::get_configuration_to_ready() {
+    return latencies.get_histogram(SESSION_LATENCIES, CONFIGURATION_TO_READY);
+}
+
 void AdapterCore::start() {
     spdlog::info("AdapterCore::start");
     if (state == DISCONNECTED) {
+        // Build the announcement before it is needed in on_open.
+        get_announcement();
         spdlog::info("AdapterCore: connecting to AMP's broker.");
-        broker_connection_ptr->connect();
+        if (broker_connection_ptr != 0) {
+            broker_connection_ptr->connect();
+        }
     } else {
         std::string message = "Adapter started while already connected.";
         spdlog::error(message);
@@ -32,20 +112,31 @@ void AdapterCore::start() {
 }
 
 void AdapterCore::on_open() {
+    dispatch(std::bind(&AdapterCore::process_open, this));
+}
+
+void AdapterCore::process_open() {
     spdlog::info("AdapterCore::on_open");
 
     if (state == DISCONNECTED) {
         state = CONNECTED;
+        reconnect_scheduler.reset();
+
+        if (sut_backlog && broker_connection_ptr != 0) {
+            broker_connection_ptr->pause_reading();
+        }
 
         spdlog::info("AdapterCore: sending announcement to AMP");
-        std::vector<Label> labels = handler_ptr->get_supported_labels();
-        Configuration configuration = handler_ptr->get_configuration();
-        Announcement announcement =
-            axini::announcement(adapter_name, labels, configuration);
-        Message message = axini::message(announcement);
-        send_message(message);
+        const std::string& announcement = get_announcement();
+        if (recorder_ptr != 0) {
+            recorder_ptr->record(TO_AMP, announcement, LatencyRecorder::now());
+        }
+        if (broker_connection_ptr != 0) {
+            broker_connection_ptr->send((void *) announcement.c_str(), announcement.size());
+        }
 
         state = ANNOUNCED;
+        preconnect_sut();
 
     } else {
         std::string message = "Connection openend while already connected";
@@ -54,9 +145,34 @@ void AdapterCore::on_open() {
     }
 }
 
-// BrokerConnection: connection is closed.
-// * stop the handler
+// The serialized announcement is built once and reused for every (re)connect.
+// It is rebuilt when the handler reports that its labels or its default
+// configuration have changed.
+const std::string& AdapterCore::get_announcement() {
+    unsigned long version = handler_ptr->get_announcement_version();
+    if (announcement_bytes.empty() || version != announcement_version) {
+        spdlog::info("AdapterCore: building announcement");
+        std::vector<Label> labels = handler_ptr->get_supported_labels();
+        Configuration configuration = handler_ptr->default_configuration();
+        Message message;
+        *message.mutable_announcement() =
+            axini::announcement(adapter_name, labels, configuration);
+        if (!message.SerializeToString(&announcement_bytes)) {
+            spdlog::error("AdapterCore: failed to serialize announcement.");
+        }
+        announcement_version = version;
+    }
+    return announcement_bytes;
+}
+
+// BrokerConnection: connection is closed, or could not be established.
+// * stop the handler (unless the connection with the SUT is kept),
+// * reconnect to AMP after a backoff delay.
 void AdapterCore::on_close(int code, std::string reason) {
+    dispatch(std::bind(&AdapterCore::process_close, this, code, reason));
+}
+
+void AdapterCore::process_close(int code, std::string reason) {
     state = DISCONNECTED;
 
     std::stringstream s;
@@ -65,23 +181,90 @@ void AdapterCore::on_close(int code, std::string reason) {
       << ((code == 1006) ? " The server may not be reachable." : "");
     spdlog::info(s.str());
 
-    // close the connection with the SUT.
-    spdlog::info("AdapterCore: close the connection with the SUT.");
-    handler_ptr->stop();
+    dump_latencies();
+    drop_paced_stimuli();
+
+    // The responses which were buffered for AMP are gone.
+    if (amp_backlog) {
+        amp_backlog = false;
+        handler_ptr->resume_reading();
+    }
+
+    if (keep_sut_connection) {
+        spdlog::info("AdapterCore: keeping the connection with the SUT.");
+    } else {
+        // close the connection with the SUT.
+        spdlog::info("AdapterCore: close the connection with the SUT.");
+        handler_ptr->stop();
+    }
 
     // reconnect to AMP - keep the adapter alive.
-    spdlog::info("AdapterCore: reconnecting to AMP.");
-    start();
+    long delay = reconnect_scheduler.next_delay();
+    spdlog::info("AdapterCore: reconnecting to AMP in " + std::to_string(delay) +
+                 " ms (attempt " + std::to_string(reconnect_scheduler.get_attempts()) + ").");
+    reconnect(delay);
+}
+
+// Most test runs use the default configuration, so the connection with the
+// SUT can already be set up while AMP is processing the announcement.
+// Ready is not sent to AMP before the configuration has been received.
+void AdapterCore::preconnect_sut() {
+    preconnected = false;
+    preconnect_ready = false;
+    if (!preconnect || handler_ptr->is_started()) {
+        return;
+    }
+
+    spdlog::info("AdapterCore: pre-connecting to the SUT with the default configuration.");
+    preconnected = true;
+    handler_ptr->set_configuration(handler_ptr->default_configuration());
+    handler_ptr->start();
+}
+
+void AdapterCore::reconnect(long delay) {
+    // Build the announcement before it is needed in on_open.
+    get_announcement();
+    if (broker_connection_ptr != 0) {
+        broker_connection_ptr->connect_after(delay);
+    }
 }
 
 // Configuration received from AMP.
 // * configure the handler,
-// * start the handler,
+// * start the handler (or reset it, if its connection with the SUT has been
+//   kept and the configuration has not changed),
 // * send ready to AMP (should be done by handler).
-void AdapterCore::on_configuration(Configuration configuration) {
+void AdapterCore::on_configuration(const Configuration& configuration) {
     spdlog::info("AdapterCore::on_configuration");
-
+    configuration_time = LatencyRecorder::now();
     if (state == ANNOUNCED) {
+        configure_pacer(configuration);
+    }
+
+    bool reusable = state == ANNOUNCED && (preconnected || keep_sut_connection) &&
+        handler_ptr->is_started() &&
+        google::protobuf::util::MessageDifferencer::Equals(
+            configuration, handler_ptr->get_snapshot()->get_configuration());
+
+    if (reusable && preconnected) {
+        state = CONFIGURED;
+        preconnected = false;
+        spdlog::info("AdapterCore: adopting the pre-connected connection with the SUT.");
+        if (preconnect_ready) {
+            send_ready();
+        }
+        // Otherwise the handler calls send_ready() when it is ready.
+
+    } else if (reusable) {
+        state = CONFIGURED;
+        spdlog::info("AdapterCore: reusing the connection with the SUT.");
+        handler_ptr->reset();
+
+    } else if (state == ANNOUNCED) {
+        if (preconnected) {
+            spdlog::info("AdapterCore: dropping the pre-connected connection with the SUT.");
+            preconnected = false;
+        }
         handler_ptr->set_configuration(configuration);
         state = CONFIGURED;
 
@@ -99,20 +282,47 @@ void AdapterCore::on_configuration(Configuration configuration) {
     }
 }
 
+// The pacing is part of the configuration (of the handler).
+void AdapterCore::configure_pacer(const Configuration& configuration) {
+    if (pacer_ptr == 0) {
+        return;
+    }
+    ConfigurationSnapshot snapshot(configuration);
+    long queue_limit = snapshot.has(STIMULUS_QUEUE_KEY) ?
+        snapshot.get_integer(STIMULUS_QUEUE_KEY) : 1000;
+    pacer_ptr->configure(snapshot.get_float(STIMULUS_RATE_KEY),
+                         snapshot.get_integer(STIMULUS_BURST_KEY),
+                         queue_limit > 0 ? queue_limit : 0);
+}
+
 // Label (stimulus) received from AMP.
-// * make handler offer the stimulus to the SUT,
+// * make handler offer the stimulus to the SUT, unless it has to wait for
+//   the StimulusPacer,
 // * acknowledge the actual stimulus to AMP.
 // TODO: check that the label is indeed a stimulus.
-void AdapterCore::on_label(Label label) {
-    std::string label_name = label.label();
-    spdlog::info("AdapterCore::on_label: " + label_name);
+void AdapterCore::on_label(Message* message, long receive_time, long parse_time) {
+    const Label& label = message->label();
+    LOG_HOT_INFO("AdapterCore::on_label: {}", label.label());
 
     if (state == READY) {
-        spdlog::info("AdapterCore: forwarding label to Handler object");
-        long correlation_id = label.correlation_id();
-        std::string physical_label = handler_ptr->stimulate(label);
-        long timestamp = axini::current_timestamp();
-        send_stimulus(label, physical_label, timestamp, correlation_id);
+        if (pacer_ptr != 0 && pacer_ptr->is_enabled()) {
+            if (pacer_ptr->try_send(label.channel(), parse_time)) {
+                latencies.record(label.label(), PACING_QUEUE_DELAY, 0);
+            } else {
+                // The message lives on the arena of process_message: copy it.
+                std::shared_ptr<Message> waiting(new Message(*message));
+                if (!pacer_ptr->enqueue(label.channel(),
+                        std::bind(&AdapterCore::send_paced_stimulus,
+                                  this, waiting, receive_time, parse_time))) {
+                    std::string error_message =
+                        "AdapterCore: too many stimuli waiting to be sent to the SUT.";
+                    spdlog::error(error_message);
+                    send_error(error_message);
+                }
+                return;
+            }
+        }
+        forward_stimulus(message, receive_time, parse_time);
 
     } else {
         std::string message = "AdapterCore: label received from AMP while *not* ready.";
@@ -121,11 +331,57 @@ void AdapterCore::on_label(Label label) {
     }
 }
 
+// The label is acknowledged by sending the received message back, so that
+// the label is never copied. The timestamp of the acknowledgement is the time
+// the connection took when the stimulus was handed to it for writing to the
+// SUT, also when it has waited for the pacer.
+void AdapterCore::forward_stimulus(Message* message, long receive_time, long parse_time) {
+    const Label& label = message->label();
+    LOG_HOT_INFO("AdapterCore: forwarding label to Handler object");
+    long correlation_id = label.correlation_id();
+    long sent_time = 0;
+    std::string physical_label = handler_ptr->stimulate(label, sent_time);
+    if (sent_time == 0) {
+        // Not sent (e.g. no connection): the time of the acknowledgement.
+        sent_time = LatencyRecorder::now();
+    }
+    long timestamp = axini::to_epoch_nanoseconds(sent_time);
+    latencies.record(label.label(), PARSE_TO_SUT_SEND, sent_time - parse_time);
+
+    send_stimulus(message, physical_label, timestamp, correlation_id);
+    latencies.record(label.label(), STIMULUS_ACKNOWLEDGEMENT,
+                     LatencyRecorder::now() - receive_time);
+}
+
+// A stimulus released by the StimulusPacer. The waiting stimuli are dropped
+// when the adapter is reset or disconnected.
+void AdapterCore::send_paced_stimulus(std::shared_ptr<Message> message, long receive_time,
+                                      long parse_time) {
+    if (state != READY) {
+        return;
+    }
+    latencies.record(message->label().label(), PACING_QUEUE_DELAY,
+                     LatencyRecorder::now() - parse_time);
+    forward_stimulus(message.get(), receive_time, parse_time);
+}
+
+// The stimuli waiting for the pacer will not be sent anymore.
+void AdapterCore::drop_paced_stimuli() {
+    if (pacer_ptr == 0) {
+        return;
+    }
+    size_t n_dropped = pacer_ptr->clear();
+    if (n_dropped > 0) {
+        spdlog::warn("AdapterCore: dropped {} stimuli waiting for the pacer.", n_dropped);
+    }
+}
+
 // Reset message received from AMP.
 // * reset the handler,
 // * send ready to AMP (should be done by handler).
 void AdapterCore::on_reset() {
     if (state == READY) {
+        drop_paced_stimuli();
         spdlog::info("AdapterCore: resetting the connection with the SUT.");
         handler_ptr->reset();
         // The handler should call send_ready() as it knows when it is ready.
@@ -139,22 +395,36 @@ void AdapterCore::on_reset() {
 
 // Error message received from AMP.
 // * close the connection to AMP
-void AdapterCore::on_error(std::string message) {
+void AdapterCore::on_error(const std::string& message) {
     state = ERROR;
     std::string msg = "AdapterCore: error message received from AMP: " + message + ".";
     spdlog::error(msg);
-    broker_connection_ptr->close(1000, message); // 1000 is normal closure...
+    if (broker_connection_ptr != 0) {
+        broker_connection_ptr->close(1000, message); // 1000 is normal closure...
+    }
 }
 
-void AdapterCore::handle_message(std::string msg) {
-    spdlog::info("AdapterCore::handle_message");
+// The receive_time is the (monotonic) time at which the message was received.
+void AdapterCore::handle_message(const std::string& msg, long receive_time) {
+    dispatch(std::bind(&AdapterCore::process_message, this, msg, receive_time));
+}
+
+// The message and all its parts are allocated on a per-message arena.
+void AdapterCore::process_message(const std::string& msg, long receive_time) {
+    axini::sample_hot_path();
+    LOG_HOT_INFO("AdapterCore::handle_message");
+    if (recorder_ptr != 0) {
+        recorder_ptr->record(FROM_AMP, msg, receive_time);
+    }
 
-    Message message;
+    axini::MessageArena arena;
+    Message& message = *google::protobuf::Arena::CreateMessage<Message>(arena.get());
 
     if (! message.ParseFromString(msg)) {
         spdlog::error("Error: could not parse the message");
         return; // TODO: should we throw an Exception?
     }
+    long parse_time = LatencyRecorder::now();
 
     if (message.has_configuration()) {
         spdlog::info("AdapterCore: configuration received from AMP");
@@ -162,9 +432,10 @@ void AdapterCore::handle_message(std::string msg) {
     }
 
     else if (message.has_label()) {
-        Label label = message.label();
-        spdlog::info("AdapterCore: label received from AMP: " + axini::to_string(label));
-        on_label(label);
+        LOG_HOT_INFO("AdapterCore: label received from AMP: {}", message.label());
+        latencies.record(message.label().label(), BROKER_RECEIVE_TO_PARSE,
+                         parse_time - receive_time);
+        on_label(&message, receive_time, parse_time);
     }
 
     else if (message.has_reset()) {
@@ -193,45 +464,128 @@ void AdapterCore::handle_message(std::string msg) {
 
 // Send response to AMP (callback for Handler).
 // TODO: check whether the label is indeed a response.
-void AdapterCore::send_response(Label label, std::string physical_label,
-                                long timestamp) {
-    spdlog::info("AdapterCore::send_response (to AMP): " + axini::to_string(label));
-    Label new_label = axini::label(label, physical_label, timestamp);
-    Message message = axini::message(new_label);
-    send_message(message);
+// The receive_time is the (monotonic) time at which the response was received
+// from the SUT.
+void AdapterCore::send_response(const Label& label, const std::string& physical_label,
+                                long timestamp, long receive_time) {
+    LOG_HOT_INFO("AdapterCore::send_response (to AMP): {}", label);
+    axini::MessageArena arena;
+    Message* message = axini::message(arena.get(), label);
+    axini::stamp_label(message->mutable_label(), physical_label, timestamp);
+    send_message(*message);
+    latencies.record(label.label(), SUT_RECEIVE_TO_BROKER_SEND,
+                     LatencyRecorder::now() - receive_time);
+    if (observer_ptr != 0) {
+        observer_ptr->on_response(label, receive_time);
+    }
 }
 
-// Send Ready to AMP
+// Send Ready to AMP.
+// A pre-connected handler may be ready before AMP has sent the configuration;
+// Ready is then sent when the configuration is received.
 void AdapterCore::send_ready() {
+    if (state == ANNOUNCED && preconnected) {
+        spdlog::info("AdapterCore: the pre-connected SUT is ready.");
+        preconnect_ready = true;
+        return;
+    }
+
     spdlog::info("AdapterCore::send_ready to AMP");
-    send_message(axini::message_ready());
+    axini::MessageArena arena;
+    send_message(*axini::message_ready(arena.get()));
+    if (state == CONFIGURED) {
+        latencies.record(SESSION_LATENCIES, CONFIGURATION_TO_READY,
+                         LatencyRecorder::now() - configuration_time);
+    }
     state = READY;
+    if (observer_ptr != 0) {
+        observer_ptr->on_ready();
+    }
 }
 
-void AdapterCore::send_message(Message message) {
+// The serialization buffer is reused for all messages sent from this thread.
+// Without a BrokerConnection (e.g. in benchmarks) the message is serialized
+// but not sent.
+void AdapterCore::send_message(const Message& message) {
     // spdlog::info("AdapterCore::send_message");
-    std::string str;
+    static thread_local std::string str;
     if (!message.SerializeToString(&str)) {
         spdlog::error("AdapterCore: failed to serialize ProtoBuf message.");
         return; // TODO: should we throw an exeption
     }
-    broker_connection_ptr->send((void *) str.c_str(), message.ByteSizeLong());
+    if (recorder_ptr != 0) {
+        recorder_ptr->record(TO_AMP, str, LatencyRecorder::now());
+    }
+    if (broker_connection_ptr != 0) {
+        broker_connection_ptr->send((void *) str.c_str(), str.size());
+    }
 }
 
-// Acknowledge stimulus to AMP.
+// Acknowledge stimulus to AMP: the label of the received message is updated
+// in place and the message is sent back.
 // TODO: check that the label is indeed a stimulus.
-void AdapterCore::send_stimulus(Label label, std::string physical_label,
+void AdapterCore::send_stimulus(Message* message, const std::string& physical_label,
                                 long timestamp, long correlation_id) {
-    spdlog::info("AdapterCore::send_stimulus (back to AMP): " + axini::to_string(label));
-    Label new_label = axini::label(label, physical_label, timestamp, correlation_id);
-    Message message = axini::message(new_label);
-    send_message(message);
+    LOG_HOT_INFO("AdapterCore::send_stimulus (back to AMP): {}", message->label());
+    axini::stamp_label(message->mutable_label(), physical_label, timestamp, correlation_id);
+    send_message(*message);
 }
 
 // Send Error message to AMP (also callback for Handler).
-void AdapterCore::send_error(std::string error_message) {
+void AdapterCore::send_error(const std::string& error_message) {
     spdlog::info("AdapterCore::send_error");
-    Message message = axini::message_error(error_message);
-    send_message(message);
-    broker_connection_ptr->close(1000, error_message); // 1000 is normal closure
+    axini::MessageArena arena;
+    send_message(*axini::message_error(arena.get(), error_message));
+    if (broker_connection_ptr != 0) {
+        broker_connection_ptr->close(1000, error_message); // 1000 is normal closure
+    }
+}
+
+// Latencies measured by the Handler, e.g. RESET_ROUND_TRIP.
+void AdapterCore::record_latency(const std::string& name, LatencyLeg leg, long nanoseconds) {
+    latencies.record(name, leg, nanoseconds);
+}
+
+void AdapterCore::on_amp_backpressure(bool high) {
+    dispatch(std::bind(&AdapterCore::process_amp_backpressure, this, high));
+}
+
+void AdapterCore::process_amp_backpressure(bool high) {
+    if (high == amp_backlog || state == DISCONNECTED) {
+        return;
+    }
+    amp_backlog = high;
+    if (high) {
+        handler_ptr->pause_reading();
+    } else {
+        handler_ptr->resume_reading();
+    }
+}
+
+void AdapterCore::set_sut_backpressure(bool high) {
+    if (high == sut_backlog) {
+        return;
+    }
+    sut_backlog = high;
+    if (broker_connection_ptr == 0 || state == DISCONNECTED) {
+        return;
+    }
+    if (high) {
+        broker_connection_ptr->pause_reading();
+    } else {
+        broker_connection_ptr->resume_reading();
+    }
+}
+
+// Log the latency percentiles per label and the write statistics of the
+// connections to AMP and the SUT (also on demand, see adapter.cpp).
+void AdapterCore::dump_latencies() {
+    latencies.dump(adapter_name);
+    if (broker_connection_ptr != 0) {
+        broker_connection_ptr->dump_write_statistics();
+    }
+    handler_ptr->dump_statistics();
+    if (pacer_ptr != 0) {
+        pacer_ptr->dump_statistics();
+    }
 }
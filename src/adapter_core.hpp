@@ -3,18 +3,44 @@
 #ifndef ADAPTER_CORE_HPP
 #define ADAPTER_CORE_HPP
 
+#include <functional>
+#include <memory>
 #include <string>
 #include "handler.hpp"
+#include "latency_histogram.hpp"
+#include "reconnect_scheduler.hpp"
 
 #include "pa_protobuf.hpp"
 using namespace PluginAdapter::Api;
 
 class BrokerConnection;
+class SessionRecorder;
+class StimulusPacer;
+class WorkQueue;
 
 enum State { DISCONNECTED, CONNECTED, ANNOUNCED, CONFIGURED, READY, ERROR };
 
+// An AdapterObserver is told about the Ready messages and the responses which
+// the AdapterCore sends to AMP. It is used to drive the adapter without AMP
+// (see StimulusGenerator).
+class AdapterObserver {
+public:
+    virtual ~AdapterObserver() {}
+
+    virtual void on_ready() = 0;
+    // The receive_time is the (monotonic) time the response was received.
+    virtual void on_response(const Label& label, long receive_time) = 0;
+};
+
 // The AdapterCore keeps the State of the adapter. It communicates with the
 // BrokerConnection and the Handler, which connects to the SUT.
+// The BrokerConnection may be 0, in which case messages to AMP are dropped
+// (used by the benchmarks).
+//
+// The AdapterCore is an actor: all events, from the BrokerConnection and from
+// the connection to the SUT, are dispatched on its WorkQueue. The AdapterCore
+// and its Handler are therefore only accessed by one thread at a time, and
+// need no locks.
 class AdapterCore {
 public:
     AdapterCore(std::string name, BrokerConnection* broker_connection_ptr,
@@ -24,25 +50,94 @@ public:
     void start();
     void on_open();
     void on_close(int code, std::string reason);
-    void handle_message(std::string msg);
-    void send_response(Label label, std::string, long);
+    void handle_message(const std::string& msg, long receive_time);
+    void send_response(const Label& label, const std::string&, long, long receive_time);
     void send_ready();
 
+    // Backpressure (see water_marks.hpp): while the buffer of the connection
+    // with AMP is above its high water mark, reading from the SUT is paused;
+    // while the buffer of the connection with the SUT is, reading from AMP is
+    // paused. The BrokerConnection reports on its own thread, the Handler on
+    // the thread of the AdapterCore.
+    void on_amp_backpressure(bool high);
+    void set_sut_backpressure(bool high);
+
+    // The dump must run on the WorkQueue of the AdapterCore: use dispatch
+    // when it is requested from another thread, e.g. by a signal.
+    void dump_latencies();
+    void record_latency(const std::string& name, LatencyLeg leg, long nanoseconds);
+
+    void register_work_queue(WorkQueue* work_queue_ptr);
+
+    // Record all messages of the session, to and from AMP and the SUT.
+    void register_recorder(SessionRecorder* recorder_ptr);
+    void register_observer(AdapterObserver* observer_ptr);
+
+    // Pace the stimuli to the SUT, as set by the configuration items
+    // stimulus_rate, stimulus_burst and stimulus_queue (see stimulus_pacer.hpp).
+    void register_pacer(StimulusPacer* pacer_ptr);
+    void dispatch(std::function<void()> event);
+
+    // Keep the connection with the SUT open when the connection with AMP is
+    // lost. It is reused when AMP sends the same configuration again.
+    void set_keep_sut_connection(bool keep);
+
+    // Connect to the SUT with the default configuration while waiting for
+    // AMP's configuration. The connection is adopted if AMP sends the default
+    // configuration, and dropped otherwise.
+    void set_preconnect_sut(bool preconnect);
+
+    // The time from receiving the configuration until sending Ready.
+    const LatencyHistogram& get_configuration_to_ready();
+
 private:
-    void on_configuration(Configuration configuration);
-    void on_label(Label label);
+    void process_open();
+    void process_close(int code, std::string reason);
+    void process_message(const std::string& msg, long receive_time);
+    void process_amp_backpressure(bool high);
+    void reconnect(long delay);
+    void preconnect_sut();
+    const std::string& get_announcement();
+
+    void on_configuration(const Configuration& configuration);
+    void on_label(Message* message, long receive_time, long parse_time);
+    void forward_stimulus(Message* message, long receive_time, long parse_time);
+    void send_paced_stimulus(std::shared_ptr<Message> message, long receive_time,
+                             long parse_time);
+    void configure_pacer(const Configuration& configuration);
+    void drop_paced_stimuli();
     void on_reset();
-    void on_error(std::string message);
+    void on_error(const std::string& message);
 
-    void send_message(Message message);
-    void send_stimulus(Label label, std::string, long, long);
-    void send_error(std::string message);
+    void send_message(const Message& message);
+    void send_stimulus(Message* message, const std::string&, long, long);
+    void send_error(const std::string& message);
 
 private:
     std::string        adapter_name;
     BrokerConnection*  broker_connection_ptr;
     Handler*           handler_ptr;
+    WorkQueue*         work_queue_ptr;
+    SessionRecorder*   recorder_ptr;
+    AdapterObserver*   observer_ptr;
+    StimulusPacer*     pacer_ptr;
     State              state;
+
+    std::string        announcement_bytes;
+    unsigned long      announcement_version;
+
+    LatencyRecorder    latencies;
+
+    ReconnectScheduler reconnect_scheduler;
+    bool               keep_sut_connection;
+
+    bool               preconnect;
+    bool               preconnected;      // the SUT connection is speculative
+    bool               preconnect_ready;  // ... and the handler is already ready
+    long               configuration_time;
+
+    bool               amp_backlog;       // reading from the SUT is paused
+    bool               sut_backlog;       // reading from AMP is paused
 };
 
 #endif // ADAPTER_CORE_HPP
@@ -0,0 +1,109 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+#include "spdlog/spdlog.h"
+
+#include "adapter_host.hpp"
+#include "adapter_core.hpp"
+#include "broker_connection.hpp"
+#include "handler.hpp"
+#include "smartdoor_handler.hpp"
+#include "stimulus_pacer.hpp"
+
+AdapterHost::AdapterHost(size_t n_workers, size_t quantum)
+    : worker_pool(n_workers, quantum) {
+}
+
+// The AdapterHost "owns" the objects of all its sessions.
+AdapterHost::~AdapterHost() {
+    worker_pool.stop();
+    worker_pool.join();
+
+    for (Session& session : sessions) {
+        delete session.adapter_core_ptr;
+        delete session.pacer_ptr;
+        delete session.handler_ptr;
+        delete session.broker_connection_ptr;
+    }
+}
+
+void AdapterHost::add_session(SessionSpec spec) {
+    spdlog::info("AdapterHost: adding session " + spec.name + " for SUT @ " + spec.sut_url);
+
+    Session session;
+    // All connections of all sessions share the event loop of the WorkerPool.
+    boost::asio::io_service* io_service_ptr = &worker_pool.get_io_service();
+    session.broker_connection_ptr = new BrokerConnection(spec.url, spec.token, io_service_ptr);
+    session.handler_ptr = new SmartDoorHandler(spec.sut_url, io_service_ptr);
+    session.adapter_core_ptr = new AdapterCore(spec.name,
+        session.broker_connection_ptr, session.handler_ptr);
+    session.pacer_ptr = new StimulusPacer(io_service_ptr);
+
+    session.broker_connection_ptr->register_adapter_core(session.adapter_core_ptr);
+    session.handler_ptr->register_adapter_core(session.adapter_core_ptr);
+    session.adapter_core_ptr->register_work_queue(worker_pool.create_queue());
+    session.adapter_core_ptr->register_pacer(session.pacer_ptr);
+
+    sessions.push_back(session);
+}
+
+// Start all sessions and wait for the worker threads to be terminated
+// (which is never).
+void AdapterHost::run() {
+    worker_pool.run();
+
+    for (Session& session : sessions) {
+        session.adapter_core_ptr->start();
+    }
+
+    worker_pool.join();
+}
+
+// Each session is dumped on the WorkQueue of its own AdapterCore.
+void AdapterHost::dump_latencies() {
+    for (Session& session : sessions) {
+        session.adapter_core_ptr->dispatch(
+            std::bind(&AdapterCore::dump_latencies, session.adapter_core_ptr));
+    }
+}
+
+boost::asio::io_service& AdapterHost::get_io_service() {
+    return worker_pool.get_io_service();
+}
+
+// Read the sessions from a file. Each non-empty line which does not start
+// with '#' describes one session: <name> <url> <token> <sut_url>.
+std::vector<SessionSpec> AdapterHost::read_sessions(std::string filename) {
+    std::vector<SessionSpec> specs;
+
+    std::ifstream file(filename);
+    if (!file) {
+        spdlog::error("AdapterHost: cannot open sessions file " + filename);
+        return specs;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+
+        std::istringstream s(line);
+        SessionSpec spec;
+        if (!(s >> spec.name) || spec.name[0] == '#') {
+            continue;
+        }
+
+        if (!(s >> spec.url >> spec.token >> spec.sut_url)) {
+            spdlog::error("AdapterHost: " + filename + ":" + std::to_string(line_number) +
+                ": expected <name> <url> <token> <sut_url>");
+            continue;
+        }
+
+        specs.push_back(spec);
+    }
+
+    return specs;
+}
@@ -0,0 +1,54 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef ADAPTER_HOST_HPP
+#define ADAPTER_HOST_HPP
+
+#include <string>
+#include <vector>
+
+#include "worker_pool.hpp"
+
+class AdapterCore;
+class BrokerConnection;
+class Handler;
+class StimulusPacer;
+
+// The parameters of a single adapter session: the adapter name, the URL and
+// token of AMP's broker, and the URL of the SmartDoor SUT.
+struct SessionSpec {
+    std::string name;
+    std::string url;
+    std::string token;
+    std::string sut_url;
+};
+
+// The AdapterHost runs several adapter sessions in a single process.
+// Each session has its own BrokerConnection, SmartDoorHandler and AdapterCore.
+// The connections of all sessions run on the io_service of a shared WorkerPool,
+// and the events of all sessions are processed on that same WorkerPool.
+class AdapterHost {
+public:
+    AdapterHost(size_t n_workers, size_t quantum = 1);
+    ~AdapterHost();
+
+    void add_session(SessionSpec spec);
+    void run();
+    void dump_latencies();
+
+    boost::asio::io_service& get_io_service();
+
+    static std::vector<SessionSpec> read_sessions(std::string filename);
+
+private:
+    struct Session {
+        BrokerConnection*  broker_connection_ptr;
+        Handler*           handler_ptr;
+        AdapterCore*       adapter_core_ptr;
+        StimulusPacer*     pacer_ptr;
+    };
+
+    WorkerPool            worker_pool;
+    std::vector<Session>  sessions;
+};
+
+#endif // ADAPTER_HOST_HPP
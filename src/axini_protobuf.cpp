@@ -1,18 +1,21 @@
 // Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
 
+#include <limits>
 #include <string>
 #include <sstream>
 #include "axini_protobuf.hpp"
+#include "clock.hpp"
+#include "label_format.hpp"
+
+// The conversions to std::string are not capped.
+static const size_t NO_LIMIT = std::numeric_limits<size_t>::max();
 
 // Current time in nano seconds since EPOCH.
 long axini::current_timestamp() {
-    using namespace std::chrono;
-    long duration_nsec = time_point_cast<nanoseconds>(system_clock::now())
-                            .time_since_epoch().count();
-    return duration_nsec;
+    return to_epoch_nanoseconds(monotonic_now());
 }
 
-std::string axini::to_string(Message msg) {
+std::string axini::to_string(const Message& msg) {
     if (msg.has_error())
         return "error";
     else if (msg.has_announcement())
@@ -29,47 +32,26 @@ std::string axini::to_string(Message msg) {
         return "?? unknown message !!";
 }
 
-std::string axini::to_string(Label label) {
-    std::string direction = (label.type() == Label::STIMULUS) ? "?" : "!";
-    std::string channel = label.channel();
-
-    std::stringstream ps;
-    bool first_param = true;
-    for (const Label_Parameter& parameter : label.parameters()) {
-        ps << (first_param ? "" : ", ") << to_string(parameter);
-        first_param = false;
-    }
-
-    std::string parameters = (first_param ? "" : " (" + ps.str() + ")");
-
-    std::stringstream s;
-    s << direction << "[" << channel << "]" << label.label() << parameters;
-    return s.str();
+// See label_format.hpp for the format of labels and parameter values.
+std::string axini::to_string(const Label& label) {
+    fmt::memory_buffer buffer;
+    format_to(buffer, label, NO_LIMIT);
+    return fmt::to_string(buffer);
 }
 
-std::string axini::to_string(Label_Parameter param) {
-    std::stringstream s;
-    s << param.name() << ": " << to_string(param.value());
-    return s.str();
+std::string axini::to_string(const Label_Parameter& param) {
+    fmt::memory_buffer buffer;
+    format_to(buffer, param, NO_LIMIT);
+    return fmt::to_string(buffer);
 }
 
-// TODO: add code for date, time, array, struct and hash parameters.
-// These are not needed for the SmartDoor SUT, though.
-std::string axini::to_string(Label_Parameter_Value val) {
-    if (val.has_string())
-        return val.string();
-    else if (val.has_integer())
-        return std::to_string(val.integer());
-    else if (val.has_decimal())
-        return std::to_string(val.decimal());
-    else if (val.has_boolean())
-        return (val.boolean() ? "true" : "false");
-    else {
-        return "not yet implemented";
-    }
+std::string axini::to_string(const Label_Parameter_Value& val) {
+    fmt::memory_buffer buffer;
+    format_to(buffer, val, NO_LIMIT);
+    return fmt::to_string(buffer);
 }
 
-std::string axini::to_string(Configuration config) {
+std::string axini::to_string(const Configuration& config) {
     std::stringstream s;
     bool first_item = true;
     for (const Configuration_Item& item : config.items()) {
@@ -79,7 +61,7 @@ std::string axini::to_string(Configuration config) {
     return s.str();
 }
 
-std::string axini::to_string(Configuration_Item item) {
+std::string axini::to_string(const Configuration_Item& item) {
     std::string key = item.key();
     std::string value;
 
@@ -97,21 +79,25 @@ std::string axini::to_string(Configuration_Item item) {
     return key + " => " + value + " (" + item.description() + ")";
 }
 
-Message axini::message(Label label) {
-    Label* label_ptr = new Label(label);
+Message axini::message(const Label& label) {
     Message message;
-    message.set_allocated_label(label_ptr); // message now "owns" label_ptr
+    *message.mutable_label() = label;
     return message;
 }
 
-Message axini::message(Announcement announcement) {
-    Announcement* announcement_ptr = new Announcement(announcement);
+Message axini::message(Label&& label) {
     Message message;
-    message.set_allocated_announcement(announcement_ptr);
+    message.mutable_label()->Swap(&label); // no deep copy, both live on the heap
     return message;
 }
 
-Message axini::message_error(std::string error_message) {
+Message axini::message(const Announcement& announcement) {
+    Message message;
+    *message.mutable_announcement() = announcement;
+    return message;
+}
+
+Message axini::message_error(const std::string& error_message) {
     Message_Error* error_ptr = new Message_Error;
     error_ptr->set_message(error_message);
     Message message;
@@ -126,17 +112,35 @@ Message axini::message_ready() {
     return message;
 }
 
-Announcement axini::announcement(std::string name, std::vector<Label> labels,
-                                Configuration configuration) {
+// ----- Messages on an arena
+
+Message* axini::message(google::protobuf::Arena* arena, const Label& label) {
+    Message* message = google::protobuf::Arena::CreateMessage<Message>(arena);
+    *message->mutable_label() = label; // the copy is allocated on the arena
+    return message;
+}
+
+Message* axini::message_error(google::protobuf::Arena* arena,
+                              const std::string& error_message) {
+    Message* message = google::protobuf::Arena::CreateMessage<Message>(arena);
+    message->mutable_error()->set_message(error_message);
+    return message;
+}
 
-    Configuration* configuration_ptr = new Configuration(configuration);
+Message* axini::message_ready(google::protobuf::Arena* arena) {
+    Message* message = google::protobuf::Arena::CreateMessage<Message>(arena);
+    message->mutable_ready();
+    return message;
+}
 
+Announcement axini::announcement(const std::string& name, const std::vector<Label>& labels,
+                                 const Configuration& configuration) {
     Announcement announcement;
     announcement.set_name(name);
-    announcement.set_allocated_configuration(configuration_ptr);
+    *announcement.mutable_configuration() = configuration;
 
     // Copy labels to announcement.
-    for (Label& label : labels) {
+    for (const Label& label : labels) {
         Label* label_ptr = announcement.add_labels();
         *label_ptr = label;
     }
@@ -144,30 +148,39 @@ Announcement axini::announcement(std::string name, std::vector<Label> labels,
     return announcement;
 }
 
-Label axini::label(Label label, std::string physical_label, long timestamp) {
+Label axini::label(const Label& label, const std::string& physical_label, long timestamp) {
     Label new_label = label;
-    new_label.set_physical_label(physical_label);
-    new_label.set_timestamp(timestamp);
+    stamp_label(&new_label, physical_label, timestamp);
     return new_label;
 }
 
-Label axini::label(Label label, std::string physical_label, long timestamp,
+Label axini::label(const Label& label, const std::string& physical_label, long timestamp,
                    long correlation_id) {
     Label new_label = label;
-    new_label.set_physical_label(physical_label);
-    new_label.set_timestamp(timestamp);
-    new_label.set_correlation_id(correlation_id);
+    stamp_label(&new_label, physical_label, timestamp, correlation_id);
     return new_label;
 }
 
-Label axini::stimulus(std::string name) {
+void axini::stamp_label(Label* label, const std::string& physical_label, long timestamp) {
+    label->set_physical_label(physical_label);
+    label->set_timestamp(timestamp);
+}
+
+void axini::stamp_label(Label* label, const std::string& physical_label, long timestamp,
+                        long correlation_id) {
+    label->set_physical_label(physical_label);
+    label->set_timestamp(timestamp);
+    label->set_correlation_id(correlation_id);
+}
+
+Label axini::stimulus(const std::string& name) {
     Label label;
     label.set_type(Label::STIMULUS);
     label.set_label(name);
     return label;
 }
 
-Label axini::stimulus(std::string name, std::string channel) {
+Label axini::stimulus(const std::string& name, const std::string& channel) {
     Label label;
     label.set_type(Label::STIMULUS);
     label.set_label(name);
@@ -175,15 +188,15 @@ Label axini::stimulus(std::string name, std::string channel) {
     return label;
 }
 
-Label axini::stimulus(std::string name,
-                      std::string channel,
-                      std::vector<Label_Parameter> parameters) {
+Label axini::stimulus(const std::string& name,
+                      const std::string& channel,
+                      const std::vector<Label_Parameter>& parameters) {
     Label label;
     label.set_type(Label::STIMULUS);
     label.set_label(name);
     label.set_channel(channel);
 
-    for (Label_Parameter& parameter : parameters) {
+    for (const Label_Parameter& parameter : parameters) {
         Label_Parameter* parameter_ptr = label.add_parameters();
         *parameter_ptr = parameter;
     }
@@ -191,14 +204,14 @@ Label axini::stimulus(std::string name,
     return label;
 }
 
-Label axini::response(std::string name) {
+Label axini::response(const std::string& name) {
     Label label;
     label.set_type(Label::RESPONSE);
     label.set_label(name);
     return label;
 }
 
-Label axini::response(std::string name, std::string channel) {
+Label axini::response(const std::string& name, const std::string& channel) {
     Label label;
     label.set_type(Label::RESPONSE);
     label.set_label(name);
@@ -206,16 +219,16 @@ Label axini::response(std::string name, std::string channel) {
     return label;
 }
 
-Label axini::response(std::string name,
-                      std::string channel,
-                      std::vector<Label_Parameter> parameters) {
+Label axini::response(const std::string& name,
+                      const std::string& channel,
+                      const std::vector<Label_Parameter>& parameters) {
 
     Label label;
     label.set_type(Label::RESPONSE);
     label.set_label(name);
     label.set_channel(channel);
 
-    for (Label_Parameter& parameter : parameters) {
+    for (const Label_Parameter& parameter : parameters) {
         Label_Parameter* parameter_ptr = label.add_parameters();
         *parameter_ptr = parameter;
     }
@@ -228,15 +241,22 @@ Label axini::response(std::string name,
 // TODO: add parameter_value methods for an array, struct and hash.
 // These are not needed for the SmartDoor adapter, though.
 
-Label_Parameter axini::parameter(std::string name, Label_Parameter_Value value) {
+Label_Parameter axini::parameter(const std::string& name,
+                                 const Label_Parameter_Value& value) {
     Label_Parameter parameter;
-    Label_Parameter_Value* value_ptr = new Label_Parameter_Value(value);
     parameter.set_name(name);
-    parameter.set_allocated_value(value_ptr);
+    *parameter.mutable_value() = value;
     return parameter;
 }
 
-Label_Parameter_Value axini::parameter_value(std::string ss) {
+Label_Parameter axini::parameter(const std::string& name, Label_Parameter_Value&& value) {
+    Label_Parameter parameter;
+    parameter.set_name(name);
+    parameter.mutable_value()->Swap(&value);
+    return parameter;
+}
+
+Label_Parameter_Value axini::parameter_value(const std::string& ss) {
     Label_Parameter_Value value;
     value.set_string(ss);
     return value;
@@ -274,8 +294,8 @@ Label_Parameter_Value axini::parameter_value_time(long ll) {
     return value;
 }
 
-std::string axini::get_string_value_from(Configuration configuration,
-                                         std::string key) {
+std::string axini::get_string_value_from(const Configuration& configuration,
+                                         const std::string& key) {
     for (int i = 0; i < configuration.items_size(); i++) {
         const Configuration_Item& item = configuration.items(i);
         if (item.key() == key) {
@@ -284,3 +304,20 @@ std::string axini::get_string_value_from(Configuration configuration,
     }
     return "";
 }
+
+// ----- MessageArena
+
+axini::MessageArena::MessageArena()
+    : arena(options(initial_block, sizeof(initial_block))) {
+}
+
+google::protobuf::Arena* axini::MessageArena::get() {
+    return &arena;
+}
+
+google::protobuf::ArenaOptions axini::MessageArena::options(char* block, size_t size) {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = size;
+    return options;
+}
@@ -12,41 +12,73 @@ using namespace PluginAdapter::Api;
 namespace axini {
     long current_timestamp();
 
-    std::string to_string(Message m);
-    std::string to_string(Label l);
-    std::string to_string(Label_Parameter p);
-    std::string to_string(Label_Parameter_Value v);
-    std::string to_string(Configuration c);
-    std::string to_string(Configuration_Item item);
-
-    Message message(Label label);
-    Message message(Announcement announcement);
-    Message message_error(std::string error_message);
+    std::string to_string(const Message& m);
+    std::string to_string(const Label& l);
+    std::string to_string(const Label_Parameter& p);
+    std::string to_string(const Label_Parameter_Value& v);
+    std::string to_string(const Configuration& c);
+    std::string to_string(const Configuration_Item& item);
+
+    Message message(const Label& label);
+    Message message(Label&& label);
+    Message message(const Announcement& announcement);
+    Message message_error(const std::string& error_message);
     Message message_ready();
 
-    Announcement announcement(std::string, std::vector<Label>, Configuration);
+    // Messages allocated on an arena; the arena "owns" the returned Message.
+    Message* message(google::protobuf::Arena* arena, const Label& label);
+    Message* message_error(google::protobuf::Arena* arena, const std::string& error_message);
+    Message* message_ready(google::protobuf::Arena* arena);
+
+    Announcement announcement(const std::string&, const std::vector<Label>&,
+                              const Configuration&);
+
+    Label label(const Label&, const std::string& physical_label, long timestamp);
+    Label label(const Label&, const std::string& physical_label, long timestamp,
+                long correlation_id);
 
-    Label label(Label, std::string physical_label, long timestamp);
-    Label label(Label, std::string physical_label, long timestamp, long correlation_id);
+    // Set the physical label and timestamp of an existing label, without copying it.
+    void stamp_label(Label*, const std::string& physical_label, long timestamp);
+    void stamp_label(Label*, const std::string& physical_label, long timestamp,
+                     long correlation_id);
 
-    Label stimulus(std::string name);
-    Label stimulus(std::string name, std::string channel);
-    Label stimulus(std::string name, std::string channel, std::vector<Label_Parameter> parameters);
+    Label stimulus(const std::string& name);
+    Label stimulus(const std::string& name, const std::string& channel);
+    Label stimulus(const std::string& name, const std::string& channel,
+                   const std::vector<Label_Parameter>& parameters);
 
-    Label response(std::string name);
-    Label response(std::string name, std::string channel);
-    Label response(std::string name, std::string channel, std::vector<Label_Parameter> parameters);
+    Label response(const std::string& name);
+    Label response(const std::string& name, const std::string& channel);
+    Label response(const std::string& name, const std::string& channel,
+                   const std::vector<Label_Parameter>& parameters);
 
-    Label_Parameter parameter(std::string name, Label_Parameter_Value value);
+    Label_Parameter parameter(const std::string& name, const Label_Parameter_Value& value);
+    Label_Parameter parameter(const std::string& name, Label_Parameter_Value&& value);
 
-    Label_Parameter_Value parameter_value(std::string s);
+    Label_Parameter_Value parameter_value(const std::string& s);
     Label_Parameter_Value parameter_value(int ii);
     Label_Parameter_Value parameter_value(double dd);
     Label_Parameter_Value parameter_value(bool bb);
     Label_Parameter_Value parameter_value_date(long ll);
     Label_Parameter_Value parameter_value_time(long ll);
 
-    std::string get_string_value_from(Configuration, std::string);
+    std::string get_string_value_from(const Configuration&, const std::string&);
+
+    // A Protobuf arena for a single message. The first block of the arena is
+    // part of the MessageArena object itself, so when the MessageArena lives
+    // on the stack, small messages do not touch the heap at all.
+    class MessageArena {
+    public:
+        MessageArena();
+        google::protobuf::Arena* get();
+
+    private:
+        static google::protobuf::ArenaOptions options(char* block, size_t size);
+
+    private:
+        char                     initial_block[4096];
+        google::protobuf::Arena  arena;
+    };
 }
 
 #endif // AXINI_PROTOBUF_HPP
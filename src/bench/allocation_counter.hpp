@@ -0,0 +1,53 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// A global operator new which counts the heap allocations of the benchmark.
+// It replaces the operator new of the whole program, so this header must be
+// included by a single translation unit: the benchmark's main file.
+
+static std::atomic<long> n_allocations(0);
+
+void* operator new(size_t size) {
+    n_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = std::malloc(size);
+    if (ptr == 0) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// Counts the allocations since it was created, e.g. during the timed loop of
+// a benchmark.
+class AllocationCounter {
+public:
+    AllocationCounter() : start(n_allocations.load()) {
+    }
+
+    long count() const {
+        return n_allocations.load() - start;
+    }
+
+    // Report the allocations per iteration of a Google Benchmark as the
+    // counter "allocs".
+    template <typename State>
+    void report(State& state) const {
+        state.counters["allocs"] = (double) count() / state.iterations();
+    }
+
+private:
+    long start;
+};
+
+#endif // ALLOCATION_COUNTER_HPP
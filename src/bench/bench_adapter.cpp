@@ -0,0 +1,536 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+// End-to-end throughput and latency benchmark of the adapter, which runs
+// completely offline. The benchmark plays both sides of the adapter:
+//
+// * a local TLS WebSocket server playing AMP's broker: it waits for the
+//   announcement, sends the configuration, waits for Ready and then sends
+//   stimuli at a fixed rate or with a fixed number of outstanding stimuli;
+//   every --reset-every stimuli it ends the test case: it waits for all
+//   acknowledgements and responses, sends a Reset and waits for Ready,
+// * a local WebSocket server on port 3001 simulating the SmartDoor SUT,
+//
+// and starts the real adapter executable in between. It reports the number
+// of stimuli per second, the round-trip latencies of the stimuli (until
+// acknowledged by the adapter) and of the responses (until the SUT's response
+// has been forwarded by the adapter) and of the resets (until Ready), and the
+// CPU time and RSS of the adapter. The throughput includes the resets.
+//
+// usage: bench_adapter [--adapter <path>] [--threads <n>] [--count <n>]
+//                      [--rate <stimuli/sec>] [--concurrency <n>] [--reset-every <n>]
+//                      [--port <amp port>] [--cert <file>] [--key <file>]
+//                      [--adapter-log]
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <websocketpp/config/asio.hpp>
+#include <websocketpp/server.hpp>
+
+#include "pa_protobuf.hpp"
+#include "latency_histogram.hpp"
+
+using namespace PluginAdapter::Api;
+
+typedef websocketpp::server<websocketpp::config::asio_tls> amp_server;
+typedef websocketpp::server<websocketpp::config::asio> sut_server;
+typedef websocketpp::config::asio_tls::message_type::ptr amp_message_ptr;
+typedef websocketpp::config::asio::message_type::ptr sut_message_ptr;
+typedef websocketpp::lib::shared_ptr<websocketpp::lib::asio::ssl::context> context_ptr;
+
+using websocketpp::connection_hdl;
+using websocketpp::lib::bind;
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::placeholders::_2;
+
+const int SUT_PORT = 3001;
+
+struct BenchOptions {
+    std::string adapter;
+    std::string threads;
+    long        count;
+    double      rate;         // stimuli per second, 0 means closed loop
+    long        concurrency;  // (maximum) number of outstanding stimuli
+    long        reset_every;  // stimuli per test case, 0 means no resets
+    int         amp_port;
+    std::string cert;
+    std::string key;
+    bool        adapter_log;
+};
+
+// ----- SmartDoor simulator
+
+// The simulator does not model the state of the door: every command is
+// answered with its past tense, so that every stimulus gets a response.
+class FakeSmartDoor {
+public:
+    FakeSmartDoor(websocketpp::lib::asio::io_service* io_service_ptr) {
+        server.clear_access_channels(websocketpp::log::alevel::all);
+        server.clear_error_channels(websocketpp::log::elevel::all);
+        server.init_asio(io_service_ptr);
+        server.set_reuse_addr(true);
+        server.set_message_handler(bind(&FakeSmartDoor::on_message, this, ::_1, ::_2));
+        server.listen(SUT_PORT);
+        server.start_accept();
+    }
+
+private:
+    void on_message(connection_hdl hdl, sut_message_ptr msg) {
+        const std::string& command = msg->get_payload();
+        std::string reply;
+        if (command.compare(0, 6, "RESET:") == 0) {
+            reply = "RESET_PERFORMED";
+        } else if (command == "OPEN") {
+            reply = "OPENED";
+        } else if (command == "CLOSE") {
+            reply = "CLOSED";
+        } else if (command.compare(0, 5, "LOCK:") == 0) {
+            reply = "LOCKED";
+        } else if (command.compare(0, 7, "UNLOCK:") == 0) {
+            reply = "UNLOCKED";
+        } else {
+            reply = "INVALID_COMMAND";
+        }
+
+        websocketpp::lib::error_code ec;
+        server.send(hdl, reply, websocketpp::frame::opcode::text, ec);
+    }
+
+private:
+    sut_server server;
+};
+
+// ----- AMP
+
+class FakeAmp {
+public:
+    FakeAmp(websocketpp::lib::asio::io_service* io_service_ptr, const BenchOptions& options)
+        : io_service_ptr(io_service_ptr),
+          options(options),
+          rate_timer(*io_service_ptr),
+          ready(false),
+          finished(false),
+          resetting(false),
+          reset_start(0),
+          case_sent(0),
+          sent(0),
+          acknowledged(0),
+          responses(0),
+          errors(0),
+          resets(0) {
+        server.clear_access_channels(websocketpp::log::alevel::all);
+        server.clear_error_channels(websocketpp::log::elevel::all);
+        server.init_asio(io_service_ptr);
+        server.set_reuse_addr(true);
+        server.set_tls_init_handler(bind(&FakeAmp::on_tls_init, this, ::_1));
+        server.set_open_handler(bind(&FakeAmp::on_open, this, ::_1));
+        server.set_message_handler(bind(&FakeAmp::on_message, this, ::_1, ::_2));
+        server.listen(options.amp_port);
+        server.start_accept();
+    }
+
+    bool is_finished() {
+        return finished;
+    }
+
+    void report(double seconds) {
+        std::cout << "stimuli acknowledged: " << acknowledged << " in " << seconds << " s"
+                  << std::endl
+                  << "throughput:           " << acknowledged / seconds << " stimuli/sec"
+                  << std::endl
+                  << "responses:            " << responses << " (" << errors
+                  << " unexpected)" << std::endl
+                  << "resets:               " << resets << std::endl;
+        print_latencies("stimulus round trip", ack_latencies);
+        print_latencies("response round trip", response_latencies);
+        if (resets > 0) {
+            print_latencies("reset round trip", reset_latencies);
+        }
+    }
+
+private:
+    context_ptr on_tls_init(connection_hdl hdl) {
+        namespace ssl = websocketpp::lib::asio::ssl;
+        context_ptr ctx = websocketpp::lib::make_shared<ssl::context>(ssl::context::sslv23);
+        ctx->set_options(ssl::context::default_workarounds |
+                         ssl::context::no_sslv2 | ssl::context::no_sslv3);
+        ctx->use_certificate_chain_file(options.cert);
+        ctx->use_private_key_file(options.key, ssl::context::pem);
+        return ctx;
+    }
+
+    void on_open(connection_hdl hdl) {
+        adapter_hdl = hdl;
+    }
+
+    void on_message(connection_hdl hdl, amp_message_ptr msg) {
+        Message message;
+        if (!message.ParseFromString(msg->get_payload())) {
+            std::cerr << "bench: could not parse message from adapter" << std::endl;
+            return;
+        }
+
+        if (message.has_announcement()) {
+            send(configuration_message());
+        } else if (message.has_ready()) {
+            if (!ready) {
+                ready = true;
+                start_time = LatencyRecorder::now();
+                start_sending();
+            } else if (resetting && reset_start != 0) {
+                on_reset_ready();
+            }
+        } else if (message.has_label()) {
+            on_label(message.label());
+        } else if (message.has_error()) {
+            std::cerr << "bench: error from adapter: " << message.error().message() << std::endl;
+            finish();
+        }
+    }
+
+    void on_label(const Label& label) {
+        long now = LatencyRecorder::now();
+
+        if (label.type() == Label::STIMULUS) {
+            std::unordered_map<uint64_t, long>::iterator it =
+                outstanding.find(label.correlation_id());
+            if (it == outstanding.end()) {
+                errors++;
+                return;
+            }
+            ack_latencies.record(now - it->second);
+            outstanding.erase(it);
+            acknowledged++;
+
+            if (acknowledged == options.count) {
+                finish();
+            } else if (options.rate == 0) {
+                send_stimulus();
+            }
+        } else {
+            // The SUT answers the commands in order.
+            if (response_times.empty()) {
+                errors++;
+                return;
+            }
+            response_latencies.record(now - response_times.front());
+            response_times.pop_front();
+            responses++;
+        }
+        send_reset_when_idle();
+    }
+
+    // The test case ends after reset_every stimuli. The Reset is sent when
+    // all stimuli have been acknowledged and answered by the SUT.
+    void send_reset_when_idle() {
+        if (!resetting || reset_start != 0 || !outstanding.empty() || !response_times.empty()) {
+            return;
+        }
+        Message message;
+        message.mutable_reset();
+        reset_start = LatencyRecorder::now();
+        send(message);
+    }
+
+    void on_reset_ready() {
+        reset_latencies.record(LatencyRecorder::now() - reset_start);
+        resets++;
+        resetting = false;
+        reset_start = 0;
+        case_sent = 0;
+        if (options.rate == 0) {
+            start_sending();
+        }
+    }
+
+    void start_sending() {
+        if (options.rate > 0) {
+            schedule_tick();
+        } else {
+            for (long i = 0; i < options.concurrency && sent < options.count; i++) {
+                send_stimulus();
+            }
+        }
+    }
+
+    // Open loop: send a stimulus every 1/rate seconds, unless there are
+    // already 'concurrency' stimuli outstanding.
+    void schedule_tick() {
+        long period = (long) (1e9 / options.rate);
+        rate_timer.expires_from_now(std::chrono::nanoseconds(period));
+        rate_timer.async_wait([this](const websocketpp::lib::error_code& ec) {
+            if (ec || finished) {
+                return;
+            }
+            if ((long) outstanding.size() < options.concurrency) {
+                send_stimulus();
+            }
+            if (sent < options.count) {
+                schedule_tick();
+            }
+        });
+    }
+
+    void send_stimulus() {
+        if (sent >= options.count || resetting) {
+            return;
+        }
+        if (options.reset_every > 0 && case_sent == options.reset_every) {
+            resetting = true;
+            send_reset_when_idle();
+            return;
+        }
+
+        static const char* names[] = { "close", "lock", "unlock", "open" };
+        const char* name = names[sent % 4];
+
+        Message message;
+        Label* label = message.mutable_label();
+        label->set_type(Label::STIMULUS);
+        label->set_label(name);
+        label->set_channel("door");
+        label->set_correlation_id(sent + 1);
+        if (sent % 4 == 1 || sent % 4 == 2) {
+            Label_Parameter* parameter = label->add_parameters();
+            parameter->set_name("passcode");
+            parameter->mutable_value()->set_integer(1234);
+        }
+
+        long now = LatencyRecorder::now();
+        outstanding[sent + 1] = now;
+        response_times.push_back(now);
+        sent++;
+        case_sent++;
+        send(message);
+    }
+
+    Message configuration_message() {
+        Message message;
+        Configuration* configuration = message.mutable_configuration();
+
+        Configuration_Item* item_url = configuration->add_items();
+        item_url->set_key("url");
+        item_url->set_string("ws://localhost:" + std::to_string(SUT_PORT));
+
+        Configuration_Item* item_manufacturer = configuration->add_items();
+        item_manufacturer->set_key("manufacturer");
+        item_manufacturer->set_string("Axini");
+
+        return message;
+    }
+
+    void send(const Message& message) {
+        std::string bytes;
+        message.SerializeToString(&bytes);
+        websocketpp::lib::error_code ec;
+        server.send(adapter_hdl, bytes, websocketpp::frame::opcode::binary, ec);
+        if (ec) {
+            std::cerr << "bench: error sending to adapter: " << ec.message() << std::endl;
+        }
+    }
+
+    void finish() {
+        finished = true;
+        end_time = LatencyRecorder::now();
+        rate_timer.cancel();
+        io_service_ptr->stop();
+    }
+
+    static void print_latencies(const std::string& title, const LatencyHistogram& histogram) {
+        char line[256];
+        snprintf(line, sizeof(line),
+            "%-21s p50=%.1f p99=%.1f p99.9=%.1f max=%.1f us",
+            (title + ":").c_str(),
+            histogram.get_percentile(50.0) / 1000.0,
+            histogram.get_percentile(99.0) / 1000.0,
+            histogram.get_percentile(99.9) / 1000.0,
+            histogram.get_max() / 1000.0);
+        std::cout << line << std::endl;
+    }
+
+public:
+    long start_time;
+    long end_time;
+
+private:
+    websocketpp::lib::asio::io_service*   io_service_ptr;
+    BenchOptions                          options;
+    amp_server                            server;
+    connection_hdl                        adapter_hdl;
+    websocketpp::lib::asio::steady_timer  rate_timer;
+
+    bool  ready;
+    bool  finished;
+    bool  resetting;    // the test case has ended, no stimuli until Ready
+    long  reset_start;  // send time of the Reset, 0 while waiting to send it
+    long  case_sent;    // stimuli sent in the current test case
+    long  sent;
+    long  acknowledged;
+    long  responses;
+    long  errors;
+    long  resets;
+
+    std::unordered_map<uint64_t, long>  outstanding;     // correlation id -> send time
+    std::deque<long>                    response_times;  // send times of the commands
+    LatencyHistogram                    ack_latencies;
+    LatencyHistogram                    response_latencies;
+    LatencyHistogram                    reset_latencies;
+};
+
+// ----- the adapter process
+
+static pid_t start_adapter(const BenchOptions& options) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    if (!options.adapter_log) {
+        int dev_null = open("/dev/null", O_WRONLY);
+        dup2(dev_null, STDOUT_FILENO);
+        dup2(dev_null, STDERR_FILENO);
+        setenv("SPDLOG_LEVEL", "warn", 0);
+    }
+
+    std::string url = "wss://localhost:" + std::to_string(options.amp_port) + "/adapters";
+    execl(options.adapter.c_str(), options.adapter.c_str(), "bench@localhost",
+          url.c_str(), "bench-token", options.threads.c_str(), (char*) 0);
+    perror("bench: cannot start adapter");
+    _exit(1);
+}
+
+// CPU time (user + system) of the process in seconds.
+static double cpu_seconds(pid_t pid) {
+    std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    std::getline(file, stat);
+
+    // Skip "pid (comm)", the command may contain spaces.
+    std::istringstream s(stat.substr(stat.rfind(')') + 2));
+    std::string field;
+    unsigned long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && s >> field; i++) {
+        if (i == 14) utime = std::stoul(field);
+        if (i == 15) stime = std::stoul(field);
+    }
+    return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// Value of a field (in kB) of /proc/<pid>/status, e.g. VmRSS or VmHWM.
+static long status_kb(pid_t pid, const std::string& name) {
+    std::ifstream file("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, name.size() + 1, name + ":") == 0) {
+            return std::stol(line.substr(name.size() + 1));
+        }
+    }
+    return 0;
+}
+
+static BenchOptions parse_options(int argc, char* argv[]) {
+    BenchOptions options;
+    options.adapter     = "../adapter";
+    options.threads     = "1";
+    options.count       = 100000;
+    options.rate        = 0;
+    options.concurrency = 1;
+    options.reset_every = 1000;
+    options.amp_port    = 8443;
+    options.cert        = "bench/bench_cert.pem";
+    options.key         = "bench/bench_key.pem";
+    options.adapter_log = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (arg == "--adapter-log") {
+            options.adapter_log = true;
+        } else if (arg == "--adapter" && has_value) {
+            options.adapter = argv[++i];
+        } else if (arg == "--threads" && has_value) {
+            options.threads = argv[++i];
+        } else if (arg == "--count" && has_value) {
+            options.count = std::stol(argv[++i]);
+        } else if (arg == "--rate" && has_value) {
+            options.rate = std::stod(argv[++i]);
+        } else if (arg == "--concurrency" && has_value) {
+            options.concurrency = std::stol(argv[++i]);
+        } else if (arg == "--reset-every" && has_value) {
+            options.reset_every = std::stol(argv[++i]);
+        } else if (arg == "--port" && has_value) {
+            options.amp_port = std::stoi(argv[++i]);
+        } else if (arg == "--cert" && has_value) {
+            options.cert = argv[++i];
+        } else if (arg == "--key" && has_value) {
+            options.key = argv[++i];
+        } else {
+            std::cerr << "bench: unknown option " << arg << std::endl;
+            exit(1);
+        }
+    }
+
+    if (options.rate == 0 && options.concurrency < 1) {
+        options.concurrency = 1;
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options = parse_options(argc, argv);
+
+    websocketpp::lib::asio::io_service io_service;
+    FakeSmartDoor smartdoor(&io_service);
+    FakeAmp amp(&io_service, options);
+
+    pid_t adapter_pid = start_adapter(options);
+
+    // Give up when the adapter does not finish in time.
+    websocketpp::lib::asio::steady_timer deadline(io_service);
+    deadline.expires_from_now(std::chrono::seconds(300));
+    deadline.async_wait([&io_service](const websocketpp::lib::error_code& ec) {
+        if (!ec) {
+            std::cerr << "bench: timeout" << std::endl;
+            io_service.stop();
+        }
+    });
+
+    io_service.run();
+
+    double cpu = cpu_seconds(adapter_pid);
+    long rss = status_kb(adapter_pid, "VmRSS");
+    long peak_rss = status_kb(adapter_pid, "VmHWM");
+
+    kill(adapter_pid, SIGTERM);
+    waitpid(adapter_pid, 0, 0);
+
+    if (!amp.is_finished()) {
+        return 1;
+    }
+
+    double seconds = (amp.end_time - amp.start_time) / 1e9;
+    std::cout << "adapter threads: " << options.threads << ", "
+              << (options.rate > 0 ? "rate: " + std::to_string(options.rate) + "/sec, "
+                                   : std::string("closed loop, "))
+              << "concurrency: " << options.concurrency << ", "
+              << "reset every: " << options.reset_every << std::endl;
+    amp.report(seconds);
+    std::cout << "adapter CPU:          " << cpu << " s (" << 100.0 * cpu / seconds
+              << "% of one core, including start-up)" << std::endl
+              << "adapter RSS:          " << rss << " kB (peak " << peak_rss << " kB)"
+              << std::endl;
+
+    google::protobuf::ShutdownProtobufLibrary();
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+// Benchmark of the heap allocations per stimulus in the AdapterCore hot path.
+//
+// The 'copying' variants replay what AdapterCore used to do: parse into a
+// Message on the stack, pass Labels by value, and build the acknowledgement
+// with fresh copies. The 'arena' variants do what AdapterCore does now: parse
+// into a per-message arena and update the received label in place.
+//
+// usage: bench_allocations [<iterations>]
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "axini_protobuf.hpp"
+
+#include "allocation_counter.hpp"
+
+// ----- the variants
+
+static std::string make_label_message() {
+    std::vector<Label_Parameter> parameters;
+    parameters.push_back(axini::parameter("passcode", axini::parameter_value(1234)));
+    Label label = axini::stimulus("lock", "door", parameters);
+    label.set_correlation_id(42);
+
+    std::string bytes;
+    axini::message(label).SerializeToString(&bytes);
+    return bytes;
+}
+
+static Label pass_by_value(Label label) {
+    return label;
+}
+
+static void copying_stimulus(const std::string& bytes) {
+    Message message;
+    message.ParseFromString(bytes);
+    Label label = message.label();                       // handle_message
+    Label stimulus = pass_by_value(label);               // on_label(Label)
+    std::string physical_label = "LOCK:1234";
+    long correlation_id = stimulus.correlation_id();
+    Label ack = pass_by_value(stimulus);                 // send_stimulus(Label)
+    Label new_label = pass_by_value(ack);                // axini::label(Label, ...)
+    axini::stamp_label(&new_label, physical_label, axini::current_timestamp(), correlation_id);
+    Message reply;
+    reply.set_allocated_label(new Label(pass_by_value(new_label))); // axini::message(Label)
+    std::string str;
+    reply.SerializeToString(&str);
+}
+
+static void arena_stimulus(const std::string& bytes) {
+    axini::MessageArena arena;
+    Message* message = google::protobuf::Arena::CreateMessage<Message>(arena.get());
+    message->ParseFromString(bytes);
+    std::string physical_label = "LOCK:1234";
+    long correlation_id = message->label().correlation_id();
+    axini::stamp_label(message->mutable_label(), physical_label,
+                       axini::current_timestamp(), correlation_id);
+    static thread_local std::string str;
+    message->SerializeToString(&str);
+}
+
+static void copying_response(const Label& response) {
+    Label label = pass_by_value(response);               // send_response(Label)
+    Label new_label = pass_by_value(label);              // axini::label(Label, ...)
+    axini::stamp_label(&new_label, "OPENED", axini::current_timestamp());
+    Message message;
+    message.set_allocated_label(new Label(pass_by_value(new_label)));
+    std::string str;
+    message.SerializeToString(&str);
+}
+
+static void arena_response(const Label& response) {
+    axini::MessageArena arena;
+    Message* message = axini::message(arena.get(), response);
+    axini::stamp_label(message->mutable_label(), "OPENED", axini::current_timestamp());
+    static thread_local std::string str;
+    message->SerializeToString(&str);
+}
+
+template <typename F, typename A>
+static void measure(const std::string& name, F function, const A& argument, long iterations) {
+    function(argument); // warm up (thread_local buffers)
+
+    AllocationCounter allocations;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        function(argument);
+    }
+    double ns = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::cout << std::left << std::setw(20) << name << std::right
+              << std::setw(14) << std::fixed << std::setprecision(2)
+              << (double) allocations.count() / iterations
+              << std::setw(14) << std::setprecision(1) << ns / iterations << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    long iterations = (argc > 1) ? std::stol(argv[1]) : 200000;
+
+    std::string bytes = make_label_message();
+    Label response = axini::response("opened", "door");
+
+    std::cout << std::left << std::setw(20) << "variant" << std::right
+              << std::setw(14) << "allocs/op" << std::setw(14) << "ns/op" << std::endl;
+    measure("copying stimulus", copying_stimulus, bytes, iterations);
+    measure("arena stimulus", arena_stimulus, bytes, iterations);
+    measure("copying response", copying_response, response, iterations);
+    measure("arena response", arena_response, response, iterations);
+
+    google::protobuf::ShutdownProtobufLibrary();
+}
@@ -0,0 +1,92 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+// Microbenchmarks (Google Benchmark) of the cost of reading the clock: the
+// adapter's anchored monotonic clock versus the std::chrono clocks, followed
+// by a drift check of the anchored clock against the real-time clock.
+//
+// usage: bench_clock [--drift <seconds>] [<google benchmark options>]
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <time.h>
+
+#include <benchmark/benchmark.h>
+
+#include "clock.hpp"
+#include "axini_protobuf.hpp"
+
+static void BM_monotonic_now(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(axini::monotonic_now());
+    }
+}
+BENCHMARK(BM_monotonic_now);
+
+static void BM_current_timestamp(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(axini::current_timestamp());
+    }
+}
+BENCHMARK(BM_current_timestamp);
+
+static void BM_steady_clock(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(std::chrono::steady_clock::now());
+    }
+}
+BENCHMARK(BM_steady_clock);
+
+static void BM_system_clock(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(std::chrono::system_clock::now());
+    }
+}
+BENCHMARK(BM_system_clock);
+
+static void BM_clock_realtime(benchmark::State& state) {
+    struct timespec ts;
+    for (auto _ : state) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        benchmark::DoNotOptimize(ts);
+    }
+}
+BENCHMARK(BM_clock_realtime);
+
+// Report the drift of the anchored clock against the real-time clock once
+// per second. NTP adjustments of the real-time clock show up as drift.
+static void check_drift(int seconds) {
+    std::cout << std::endl << "drift of the anchored clock against CLOCK_REALTIME:" << std::endl;
+    for (int i = 0; i <= seconds; i++) {
+        if (i > 0) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+        std::cout << "  after " << i << " s: " << axini::clock_drift() << " ns" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int drift_seconds = 5;
+    if (argc >= 3 && std::strcmp(argv[1], "--drift") == 0) {
+        drift_seconds = std::atoi(argv[2]);
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    // Take the anchor before measuring.
+    axini::clock_drift();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    check_drift(drift_seconds);
+    return 0;
+}
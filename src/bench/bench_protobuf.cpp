@@ -0,0 +1,314 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+// Microbenchmarks (Google Benchmark) of the axini_protobuf helpers and of the
+// dispatch of messages by AdapterCore::handle_message. The labels are
+// parameterized by the number of parameters and by the size of the (string)
+// parameter values. Next to the time per iteration, the number of heap
+// allocations per iteration is reported as the counter 'allocs'.
+//
+// usage: bench_protobuf [<google benchmark options>], e.g.
+//        bench_protobuf --benchmark_filter=to_string
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "spdlog/spdlog.h"
+
+#include "axini_protobuf.hpp"
+#include "adapter_core.hpp"
+#include "configuration_snapshot.hpp"
+#include "handler.hpp"
+#include "label_format.hpp"
+#include "latency_histogram.hpp"
+
+#include "allocation_counter.hpp"
+
+// ----- test data
+
+// A stimulus with n_parameters string parameters of value_size characters.
+static Label make_label(int n_parameters, int value_size) {
+    std::vector<Label_Parameter> parameters;
+    for (int i = 0; i < n_parameters; i++) {
+        parameters.push_back(axini::parameter("parameter_" + std::to_string(i),
+            axini::parameter_value(std::string(value_size, 'x'))));
+    }
+    Label label = axini::stimulus("lock", "door", parameters);
+    label.set_correlation_id(42);
+    return label;
+}
+
+// A configuration with n_items string items, of which "url" is the last.
+static Configuration make_configuration(int n_items) {
+    Configuration configuration;
+    for (int i = 0; i < n_items - 1; i++) {
+        Configuration_Item* item = configuration.add_items();
+        item->set_key("key_" + std::to_string(i));
+        item->set_string("value_" + std::to_string(i));
+    }
+    Configuration_Item* item = configuration.add_items();
+    item->set_key("url");
+    item->set_string("ws://localhost:3001");
+    return configuration;
+}
+
+// A stimulus with a single parameter: an array of hashes, nested depth times.
+static Label make_nested_label(int depth) {
+    Label_Parameter_Value value = axini::parameter_value(42);
+    for (int i = 0; i < depth; i++) {
+        Label_Parameter_Value container;
+        Label_Parameter_Value_Hash_Entry* entry =
+            container.mutable_array()->add_values()->mutable_hash_value()->add_entries();
+        *entry->mutable_key() = axini::parameter_value(std::string("level"));
+        *entry->mutable_value() = value;
+        *container.mutable_array()->add_values() = axini::parameter_value_time(1680000000123456789L);
+        value = container;
+    }
+    std::vector<Label_Parameter> parameters;
+    parameters.push_back(axini::parameter("nested", value));
+    return axini::stimulus("lock", "door", parameters);
+}
+
+static void label_arguments(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"parameters", "size"});
+    for (int n_parameters : {0, 1, 4, 16}) {
+        for (int value_size : {8, 256}) {
+            b->Args({n_parameters, value_size});
+        }
+    }
+}
+
+// ----- helpers
+
+static void BM_to_string(benchmark::State& state) {
+    Label label = make_label(state.range(0), state.range(1));
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        std::string s = axini::to_string(label);
+        benchmark::DoNotOptimize(s);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_to_string)->Apply(label_arguments);
+
+// The former implementation of axini::to_string(Label), with stringstreams
+// and temporary strings (and without date, time, array, struct and hash).
+static std::string stringstream_to_string(const Label_Parameter_Value& val) {
+    if (val.has_string())
+        return val.string();
+    else if (val.has_integer())
+        return std::to_string(val.integer());
+    else if (val.has_decimal())
+        return std::to_string(val.decimal());
+    else if (val.has_boolean())
+        return (val.boolean() ? "true" : "false");
+    else
+        return "not yet implemented";
+}
+
+static std::string stringstream_to_string(const Label& label) {
+    std::string direction = (label.type() == Label::STIMULUS) ? "?" : "!";
+    std::string channel = label.channel();
+
+    std::stringstream ps;
+    bool first_param = true;
+    for (const Label_Parameter& parameter : label.parameters()) {
+        std::stringstream s;
+        s << parameter.name() << ": " << stringstream_to_string(parameter.value());
+        ps << (first_param ? "" : ", ") << s.str();
+        first_param = false;
+    }
+
+    std::string parameters = (first_param ? "" : " (" + ps.str() + ")");
+
+    std::stringstream s;
+    s << direction << "[" << channel << "]" << label.label() << parameters;
+    return s.str();
+}
+
+static void BM_to_string_stringstream(benchmark::State& state) {
+    Label label = make_label(state.range(0), state.range(1));
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        std::string s = stringstream_to_string(label);
+        benchmark::DoNotOptimize(s);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_to_string_stringstream)->Apply(label_arguments);
+
+// Formatting into a reused buffer, as the logger does.
+static void BM_format_to(benchmark::State& state) {
+    Label label = make_label(state.range(0), state.range(1));
+    fmt::memory_buffer buffer;
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        buffer.clear();
+        axini::format_to(buffer, label);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_format_to)->Apply(label_arguments);
+
+static void BM_format_to_nested(benchmark::State& state) {
+    Label label = make_nested_label(state.range(0));
+    fmt::memory_buffer buffer;
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        buffer.clear();
+        axini::format_to(buffer, label);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_format_to_nested)->ArgName("depth")->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+// A huge parameter value is cut off at the limit.
+static void BM_format_to_capped(benchmark::State& state) {
+    Label label = make_label(1, state.range(0));
+    fmt::memory_buffer buffer;
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        buffer.clear();
+        axini::format_to(buffer, label);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_format_to_capped)->ArgName("size")->Arg(1 << 10)->Arg(1 << 20);
+
+static void BM_label(benchmark::State& state) {
+    Label label = make_label(state.range(0), state.range(1));
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        Label new_label = axini::label(label, "LOCK:1234", 1680000000000000000L, 42);
+        benchmark::DoNotOptimize(new_label);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_label)->Apply(label_arguments);
+
+static void BM_stamp_label(benchmark::State& state) {
+    Label label = make_label(state.range(0), state.range(1));
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        axini::stamp_label(&label, "LOCK:1234", 1680000000000000000L, 42);
+        benchmark::DoNotOptimize(label);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_stamp_label)->Apply(label_arguments);
+
+static void BM_message(benchmark::State& state) {
+    Label label = make_label(state.range(0), state.range(1));
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        Message message = axini::message(label);
+        benchmark::DoNotOptimize(message);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_message)->Apply(label_arguments);
+
+static void BM_message_arena(benchmark::State& state) {
+    Label label = make_label(state.range(0), state.range(1));
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        axini::MessageArena arena;
+        Message* message = axini::message(arena.get(), label);
+        benchmark::DoNotOptimize(message);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_message_arena)->Apply(label_arguments);
+
+static void BM_get_string_value_from(benchmark::State& state) {
+    Configuration configuration = make_configuration(state.range(0));
+    std::string key = "url";
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        std::string value = axini::get_string_value_from(configuration, key);
+        benchmark::DoNotOptimize(value);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_get_string_value_from)->ArgName("items")->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+static void BM_snapshot_get_string(benchmark::State& state) {
+    ConfigurationSnapshot snapshot(make_configuration(state.range(0)));
+    ConfigurationKey key("url");
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        const std::string& value = snapshot.get_string(key);
+        benchmark::DoNotOptimize(value);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_snapshot_get_string)->ArgName("items")->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+// ----- AdapterCore dispatch
+
+// A Handler which does not connect to a SUT: it is ready as soon as it is
+// started and every stimulus maps to the same physical label.
+class NullHandler : public Handler {
+public:
+    void start() { send_ready_to_amp(); }
+    void stop() { }
+    void reset() { send_ready_to_amp(); }
+
+    std::string stimulate(const Label& stimulus, long& send_time) {
+        send_time = 0;
+        return "LOCK:1234";
+    }
+
+    Configuration default_configuration() { return Configuration(); }
+
+    std::vector<Label> get_supported_labels() {
+        std::vector<Label> labels;
+        labels.push_back(axini::stimulus("lock", "door"));
+        return labels;
+    }
+};
+
+// AdapterCore::handle_message for a stimulus, without a BrokerConnection:
+// parse, dispatch to the handler and serialize the acknowledgement.
+static void BM_handle_message(benchmark::State& state) {
+    NullHandler handler;
+    AdapterCore adapter_core("bench", 0, &handler);
+    handler.register_adapter_core(&adapter_core);
+
+    std::string configuration_bytes;
+    Message configuration_message;
+    *configuration_message.mutable_configuration() = make_configuration(1);
+    configuration_message.SerializeToString(&configuration_bytes);
+
+    adapter_core.on_open();
+    adapter_core.handle_message(configuration_bytes, LatencyRecorder::now());
+
+    std::string label_bytes;
+    axini::message(make_label(state.range(0), state.range(1))).SerializeToString(&label_bytes);
+
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        adapter_core.handle_message(label_bytes, LatencyRecorder::now());
+    }
+    allocations.report(state);
+    state.SetBytesProcessed(state.iterations() * label_bytes.size());
+}
+BENCHMARK(BM_handle_message)->Apply(label_arguments);
+
+int main(int argc, char* argv[]) {
+    // Keep the hot path log statements of AdapterCore out of the measurements.
+    spdlog::set_level(spdlog::level::warn);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
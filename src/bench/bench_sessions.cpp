@@ -0,0 +1,153 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+// Benchmark for the AdapterHost's WorkerPool: how does the number of sessions
+// that can be handled scale with the number of worker threads (cores)?
+//
+// Each simulated session receives label messages from "AMP", which are
+// processed like AdapterCore does: parse the Message, format the Label,
+// build the acknowledgement and serialize it. One chatty session sends ten
+// times as many messages as the others, to show that it cannot starve them.
+//
+// usage: bench_sessions [<sessions> [<messages per session>]]
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "worker_pool.hpp"
+#include "axini_protobuf.hpp"
+
+using std::chrono::steady_clock;
+
+static std::string make_label_message(int passcode) {
+    std::vector<Label_Parameter> parameters;
+    parameters.push_back(axini::parameter("passcode", axini::parameter_value(passcode)));
+    Label label = axini::stimulus("lock", "door", parameters);
+    label.set_correlation_id(passcode);
+
+    std::string bytes;
+    axini::message(label).SerializeToString(&bytes);
+    return bytes;
+}
+
+// The work done by AdapterCore for a single stimulus, minus the I/O.
+static void process_message(const std::string& bytes) {
+    Message message;
+    message.ParseFromString(bytes);
+    Label label = message.label();
+    std::string text = axini::to_string(label);
+    Label ack = axini::label(label, "LOCK:" + std::to_string(text.size()),
+                             axini::current_timestamp(), label.correlation_id());
+    std::string out;
+    axini::message(ack).SerializeToString(&out);
+}
+
+struct Result {
+    double seconds;
+    double quiet_done;   // time at which the last quiet session finished
+    double chatty_done;  // time at which the chatty session finished
+};
+
+static Result run(size_t n_workers, int n_sessions, int n_messages,
+                  const std::string& bytes) {
+    // Declared before the pool: the last task may still use them after the
+    // wait below has returned, until the pool has joined its threads.
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    std::atomic<int> sessions_left(n_sessions);
+    std::vector<double> done_at(n_sessions, 0.0);
+
+    WorkerPool pool(n_workers);
+    std::vector<WorkQueue*> queues;
+    for (int i = 0; i < n_sessions; i++) {
+        queues.push_back(pool.create_queue());
+    }
+
+    pool.run();
+    steady_clock::time_point start = steady_clock::now();
+
+    // Session 0 is the chatty one.
+    for (int m = 0; m < n_messages * 10; m++) {
+        for (int s = 0; s < n_sessions; s++) {
+            int count = (s == 0) ? n_messages * 10 : n_messages;
+            if (m >= count) continue;
+
+            bool last = (m == count - 1);
+            queues[s]->post([&, s, last]() {
+                process_message(bytes);
+                if (last) {
+                    done_at[s] = std::chrono::duration<double>(
+                        steady_clock::now() - start).count();
+                    if (--sessions_left == 0) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        done_cv.notify_all();
+                    }
+                }
+            });
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&]() { return sessions_left == 0; });
+    }
+
+    Result result;
+    result.seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+    result.chatty_done = done_at[0];
+    result.quiet_done = 0.0;
+    for (int s = 1; s < n_sessions; s++) {
+        result.quiet_done = std::max(result.quiet_done, done_at[s]);
+    }
+    return result;
+}
+
+// A number of sessions or messages: a positive number, or 0 if the value is
+// not one.
+static int parse_count(const char* value) {
+    char* end = 0;
+    long count = std::strtol(value, &end, 10);
+    if (end == value || *end != '\0' || count < 1 || count > INT_MAX) {
+        return 0;
+    }
+    return count;
+}
+
+int main(int argc, char* argv[]) {
+    int n_sessions = (argc > 1) ? parse_count(argv[1]) : 64;
+    int n_messages = (argc > 2) ? parse_count(argv[2]) : 2000;
+    if (argc > 3 || n_sessions == 0 || n_messages == 0) {
+        std::cout << "usage: bench_sessions [<sessions> [<messages per session>]]" << std::endl;
+        return 1;
+    }
+    size_t n_cores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::string bytes = make_label_message(1234);
+    long total = (long) n_messages * (n_sessions - 1) + (long) n_messages * 10;
+
+    std::cout << n_sessions << " sessions, " << n_messages << " messages per session"
+              << " (chatty session: " << n_messages * 10 << ")" << std::endl;
+    std::cout << std::setw(8) << "workers" << std::setw(14) << "msgs/sec"
+              << std::setw(18) << "msgs/sec/worker" << std::setw(14) << "quiet done"
+              << std::setw(14) << "chatty done" << std::endl;
+
+    for (size_t n_workers = 1; n_workers <= n_cores; n_workers *= 2) {
+        Result r = run(n_workers, n_sessions, n_messages, bytes);
+        double rate = total / r.seconds;
+        std::cout << std::setw(8) << n_workers
+                  << std::setw(14) << std::fixed << std::setprecision(0) << rate
+                  << std::setw(18) << rate / n_workers
+                  << std::setw(13) << std::setprecision(3) << r.quiet_done << "s"
+                  << std::setw(13) << r.chatty_done << "s" << std::endl;
+    }
+
+    google::protobuf::ShutdownProtobufLibrary();
+}
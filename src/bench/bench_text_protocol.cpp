@@ -0,0 +1,178 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+// Microbenchmarks (Google Benchmark) of the conversion between Labels and
+// SUT messages: the hand-written converters of the SmartDoorHandler versus
+// the converters compiled from protocols/smartdoor.spec by the
+// TextProtocolHandler. The parameterized responses, which the SmartDoor does
+// not have, are only measured for the TextProtocol. Next to the time, the
+// number of heap allocations per iteration is reported (allocs).
+//
+// usage: bench_text_protocol [--spec <file>] [<google benchmark options>]
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "spdlog/spdlog.h"
+
+#include "axini_protobuf.hpp"
+#include "smartdoor_handler.hpp"
+#include "text_protocol.hpp"
+#include "text_protocol_handler.hpp"
+
+#include "allocation_counter.hpp"
+
+// ----- test data
+
+static std::string spec_file = "protocols/smartdoor.spec";
+
+// Responses with parameters, added to the SmartDoor spec.
+static const char* PARAMETERIZED_SPEC =
+    "response locked_by   LOCKED_BY:{user:string}:{attempts:int}\n"
+    "response battery     BATTERY:{level:decimal}\n"
+    "response alarm       ALARM:{armed:bool}\n";
+
+// The converters are protected; these classes make them accessible.
+class HandwrittenConverters : public SmartDoorHandler {
+public:
+    using SmartDoorHandler::sut_message_to_label;
+    using SmartDoorHandler::label_to_sut_message;
+};
+
+class SpecConverters : public TextProtocolHandler {
+public:
+    SpecConverters() : TextProtocolHandler(spec_file, SMARTDOOR_URL) {
+    }
+
+    using TextProtocolHandler::sut_message_to_label;
+    using TextProtocolHandler::label_to_sut_message;
+};
+
+static std::vector<Label> make_stimuli() {
+    std::vector<Label_Parameter> passcode;
+    passcode.push_back(axini::parameter("passcode", axini::parameter_value(1234)));
+
+    std::vector<Label> stimuli;
+    stimuli.push_back(axini::stimulus("open", "door"));
+    stimuli.push_back(axini::stimulus("close", "door"));
+    stimuli.push_back(axini::stimulus("lock", "door", passcode));
+    stimuli.push_back(axini::stimulus("unlock", "door", passcode));
+    return stimuli;
+}
+
+static std::vector<std::string> make_responses() {
+    std::vector<std::string> responses;
+    responses.push_back("OPENED");
+    responses.push_back("CLOSED");
+    responses.push_back("LOCKED");
+    responses.push_back("UNLOCKED");
+    responses.push_back("INVALID_COMMAND");
+    responses.push_back("INVALID_PASSCODE");
+    responses.push_back("INCORRECT_PASSCODE");
+    responses.push_back("SHUT_OFF");
+    return responses;
+}
+
+static std::vector<std::string> make_parameterized_responses() {
+    std::vector<std::string> responses;
+    responses.push_back("LOCKED_BY:alice:3");
+    responses.push_back("BATTERY:87.5");
+    responses.push_back("ALARM:true");
+    responses.push_back("LOCKED_BY:bob:12");
+    return responses;
+}
+
+// ----- stimuli
+
+static bool is_loaded(HandwrittenConverters& converters) {
+    return true;
+}
+
+static bool is_loaded(SpecConverters& converters) {
+    return converters.is_loaded();
+}
+
+template <class Converters>
+static void BM_encode(benchmark::State& state) {
+    Converters converters;
+    if (!is_loaded(converters)) {
+        state.SkipWithError("invalid spec");
+        return;
+    }
+    std::vector<Label> stimuli = make_stimuli();
+    size_t i = 0;
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        const std::string& message = converters.label_to_sut_message(stimuli[i]);
+        benchmark::DoNotOptimize(message.data());
+        i = (i + 1) % stimuli.size();
+    }
+    allocations.report(state);
+}
+BENCHMARK_TEMPLATE(BM_encode, HandwrittenConverters);
+BENCHMARK_TEMPLATE(BM_encode, SpecConverters);
+
+// ----- responses
+
+template <class Converters>
+static void BM_decode(benchmark::State& state) {
+    Converters converters;
+    if (!is_loaded(converters)) {
+        state.SkipWithError("invalid spec");
+        return;
+    }
+    std::vector<std::string> responses = make_responses();
+    size_t i = 0;
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        const Label& label = converters.sut_message_to_label(responses[i]);
+        benchmark::DoNotOptimize(&label);
+        i = (i + 1) % responses.size();
+    }
+    allocations.report(state);
+}
+BENCHMARK_TEMPLATE(BM_decode, HandwrittenConverters);
+BENCHMARK_TEMPLATE(BM_decode, SpecConverters);
+
+static void BM_decode_parameterized(benchmark::State& state) {
+    TextProtocol protocol;
+    if (!protocol.load(spec_file) || !protocol.parse(PARAMETERIZED_SPEC)) {
+        state.SkipWithError("invalid spec");
+        return;
+    }
+    std::vector<std::string> responses = make_parameterized_responses();
+    size_t i = 0;
+    long n_unmatched = 0;
+    AllocationCounter allocations;
+    for (auto _ : state) {
+        const Label* label_ptr = protocol.decode(responses[i].data(), responses[i].size());
+        n_unmatched += (label_ptr == 0);
+        benchmark::DoNotOptimize(label_ptr);
+        i = (i + 1) % responses.size();
+    }
+    allocations.report(state);
+    if (n_unmatched > 0) {
+        state.SkipWithError("response not matched");
+    }
+}
+BENCHMARK(BM_decode_parameterized);
+
+int main(int argc, char* argv[]) {
+    if (argc >= 3 && std::strcmp(argv[1], "--spec") == 0) {
+        spec_file = argv[2];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    spdlog::set_level(spdlog::level::warn);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
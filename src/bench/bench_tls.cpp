@@ -0,0 +1,188 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+// Benchmark of the TLS handshakes of the connection with AMP, against a local
+// TLS server. The client connects repeatedly with the TlsClientContext of the
+// BrokerConnection: the first connection makes a full handshake, the next
+// connections resume its session (unless --no-resume is given). After the
+// handshake the client reads one byte from the server, so that a TLS 1.3
+// session ticket is received before the connection is closed.
+//
+// It reports the time of the first handshake and the percentiles of the
+// handshakes of the next connections, and the time to build a new TLS context
+// with the default CA store, as the BrokerConnection did on every attempt.
+//
+// usage: bench_tls [--count <n>] [--port <port>] [--cert <file>] [--key <file>]
+//                  [--tls12] [--no-resume]
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include "latency_histogram.hpp"
+#include "tls_client_context.hpp"
+
+namespace ssl = boost::asio::ssl;
+using boost::asio::ip::tcp;
+
+typedef ssl::stream<tcp::socket> tls_stream;
+
+struct BenchOptions {
+    long         count;
+    int          port;
+    std::string  cert;
+    std::string  key;
+    bool         tls12;       // limit the client to TLS 1.2
+    bool         resume;
+};
+
+// Accepts the connections one by one: handshake, write one byte, and wait
+// until the client closes the connection.
+static void run_server(boost::asio::io_service* io_service_ptr, tcp::acceptor* acceptor_ptr,
+                       ssl::context* context_ptr, long count) {
+    for (long i = 0; i < count; i++) {
+        tls_stream stream(*io_service_ptr, *context_ptr);
+        acceptor_ptr->accept(stream.lowest_layer());
+
+        boost::system::error_code ec;
+        stream.handshake(ssl::stream_base::server, ec);
+        if (ec) {
+            std::cerr << "bench: server handshake: " << ec.message() << std::endl;
+            continue;
+        }
+        char byte = 'x';
+        boost::asio::write(stream, boost::asio::buffer(&byte, 1), ec);
+        boost::asio::read(stream, boost::asio::buffer(&byte, 1), ec);
+        stream.lowest_layer().close(ec);
+    }
+}
+
+static void print_line(const std::string& title, const LatencyHistogram& histogram) {
+    char line[256];
+    snprintf(line, sizeof(line), "%-22s n=%-6lu p50=%.3f p99=%.3f max=%.3f ms",
+             title.c_str(), (unsigned long) histogram.get_count(),
+             histogram.get_percentile(50.0) / 1e6, histogram.get_percentile(99.0) / 1e6,
+             histogram.get_max() / 1e6);
+    std::cout << line << std::endl;
+}
+
+static BenchOptions parse_options(int argc, char* argv[]) {
+    BenchOptions options;
+    options.count  = 100;
+    options.port   = 8444;
+    options.cert   = "bench/bench_cert.pem";
+    options.key    = "bench/bench_key.pem";
+    options.tls12  = false;
+    options.resume = true;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (arg == "--tls12") {
+            options.tls12 = true;
+        } else if (arg == "--no-resume") {
+            options.resume = false;
+        } else if (arg == "--count" && has_value) {
+            options.count = std::stol(argv[++i]);
+        } else if (arg == "--port" && has_value) {
+            options.port = std::stoi(argv[++i]);
+        } else if (arg == "--cert" && has_value) {
+            options.cert = argv[++i];
+        } else if (arg == "--key" && has_value) {
+            options.key = argv[++i];
+        } else {
+            std::cerr << "bench: unknown option " << arg << std::endl;
+            exit(1);
+        }
+    }
+    if (options.count < 2) {
+        options.count = 2;
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options = parse_options(argc, argv);
+    if (!options.resume) {
+        setenv("ADAPTER_TLS_RESUME", "0", 1);
+    }
+
+    boost::asio::io_service io_service;
+
+    ssl::context server_context(ssl::context::sslv23);
+    server_context.set_options(ssl::context::default_workarounds |
+                               ssl::context::no_sslv2 | ssl::context::no_sslv3);
+    boost::system::error_code ec;
+    server_context.use_certificate_chain_file(options.cert, ec);
+    if (!ec) {
+        server_context.use_private_key_file(options.key, ssl::context::pem, ec);
+    }
+    if (ec) {
+        std::cerr << "bench: cannot load " << options.cert << " / " << options.key
+                  << " (make bench/bench_cert.pem): " << ec.message() << std::endl;
+        return 1;
+    }
+
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), options.port);
+    tcp::acceptor acceptor(io_service, endpoint);
+    std::thread server(run_server, &io_service, &acceptor, &server_context, options.count);
+
+    // The cost which the BrokerConnection paid on every connection attempt.
+    LatencyHistogram context_times;
+    for (int i = 0; i < 10; i++) {
+        long start = LatencyRecorder::now();
+        ssl::context context(ssl::context::sslv23);
+        context.set_default_verify_paths();
+        context_times.record(LatencyRecorder::now() - start);
+    }
+
+    TlsClientContext client_context;
+    if (options.tls12) {
+        SSL_CTX_set_max_proto_version(client_context.get_context()->native_handle(),
+                                      TLS1_2_VERSION);
+    }
+
+    LatencyHistogram first;
+    LatencyHistogram resumed;
+    LatencyHistogram full;
+    for (long i = 0; i < options.count; i++) {
+        tls_stream stream(io_service, *client_context.get_context());
+        stream.lowest_layer().connect(endpoint, ec);
+        if (ec) {
+            std::cerr << "bench: connect: " << ec.message() << std::endl;
+            break;
+        }
+        client_context.prepare(stream.native_handle());
+        stream.handshake(ssl::stream_base::client, ec);
+        if (ec) {
+            std::cerr << "bench: client handshake: " << ec.message() << std::endl;
+            break;
+        }
+        char byte;
+        boost::asio::read(stream, boost::asio::buffer(&byte, 1), ec);
+
+        long time = client_context.get_last_handshake_time();
+        if (i == 0) {
+            first.record(time);
+        } else if (client_context.was_last_handshake_resumed()) {
+            resumed.record(time);
+        } else {
+            full.record(time);
+        }
+        stream.lowest_layer().close(ec);
+    }
+    server.join();
+
+    std::cout << "TLS handshakes against localhost:" << options.port
+              << (options.tls12 ? " (TLS 1.2)" : "")
+              << (options.resume ? "" : " (no resumption)") << std::endl;
+    print_line("first handshake", first);
+    print_line("resumed handshakes", resumed);
+    print_line("full handshakes", full);
+    print_line("new context + CA store", context_times);
+    return 0;
+}
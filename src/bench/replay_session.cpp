@@ -0,0 +1,476 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+// Replays a session recorded by the adapter (ADAPTER_RECORD, see
+// session_recorder.hpp) against local fakes, without AMP and without the
+// SmartDoor SUT:
+//
+// * the messages from AMP are injected into a real AdapterCore with a real
+//   SmartDoorHandler; the "url" of the configuration is replaced by the url
+//   of the fake SUT,
+// * a local WebSocket server plays the SUT: every command is answered with
+//   the responses which followed the corresponding command in the recording.
+//
+// With --fast, the messages are replayed as fast as possible: a message from
+// AMP is injected as soon as the adapter has sent all messages to AMP which
+// preceded it in the recording. Otherwise the original timing is kept, for
+// the messages from AMP as well as for the responses of the SUT.
+//
+// Afterwards, the number of messages, the elapsed time and the messages per
+// second are reported, and the messages sent to AMP are compared with the
+// recording (by type and label; timestamps are expected to differ).
+//
+// usage: replay_session <recording> [--fast] [--port <sut port>] [--record <file>]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio/steady_timer.hpp>
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/server.hpp>
+
+#include "spdlog/spdlog.h"
+
+#include "adapter_core.hpp"
+#include "axini_protobuf.hpp"
+#include "latency_histogram.hpp"
+#include "logging.hpp"
+#include "session_recorder.hpp"
+#include "smartdoor_handler.hpp"
+#include "stimulus_pacer.hpp"
+
+typedef websocketpp::server<websocketpp::config::asio> sut_server;
+typedef websocketpp::config::asio::message_type::ptr sut_message_ptr;
+typedef std::shared_ptr<boost::asio::steady_timer> timer_ptr;
+
+using websocketpp::connection_hdl;
+using websocketpp::lib::bind;
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::placeholders::_2;
+
+// Without progress for this long, the replay gives up waiting.
+const long STALL_TIMEOUT = 2000000000L; // nanoseconds
+
+struct ReplayOptions {
+    std::string recording;
+    std::string output;     // record the replayed session, if not empty
+    bool        fast;
+    int         sut_port;
+};
+
+// A command to the SUT and the responses which followed it.
+struct SutExchange {
+    SessionRecord               command;
+    std::vector<SessionRecord>  responses;
+};
+
+static std::string payload_of(const SessionRecord& record) {
+    return std::string(record.payload, record.length);
+}
+
+static boost::asio::steady_timer::duration nanoseconds(long ns) {
+    return std::chrono::duration_cast<boost::asio::steady_timer::duration>(
+        std::chrono::nanoseconds(ns > 0 ? ns : 0));
+}
+
+// ----- fake SUT
+
+class FakeSut {
+public:
+    FakeSut(boost::asio::io_service* io_service_ptr, const std::vector<SutExchange>& exchanges,
+            int port, bool fast)
+        : io_service_ptr(io_service_ptr), exchanges(exchanges), next_exchange(0),
+          n_unexpected(0), fast(fast) {
+        server.clear_access_channels(websocketpp::log::alevel::all);
+        server.clear_error_channels(websocketpp::log::elevel::all);
+        server.init_asio(io_service_ptr);
+        server.set_reuse_addr(true);
+        server.set_message_handler(bind(&FakeSut::on_message, this, ::_1, ::_2));
+        server.listen(port);
+        server.start_accept();
+    }
+
+    void stop() {
+        server.stop_listening();
+    }
+
+    size_t get_n_commands()   { return next_exchange; }
+    long   get_n_unexpected() { return n_unexpected; }
+
+private:
+    void on_message(connection_hdl hdl, sut_message_ptr msg) {
+        if (next_exchange >= exchanges.size()) {
+            n_unexpected++;
+            return;
+        }
+        const SutExchange& exchange = exchanges[next_exchange++];
+        if (msg->get_payload() != payload_of(exchange.command)) {
+            n_unexpected++;
+        }
+
+        std::vector<SessionRecord>::const_iterator it;
+        for (it = exchange.responses.begin(); it != exchange.responses.end(); ++it) {
+            std::string response = payload_of(*it);
+            if (fast) {
+                send(hdl, response);
+            } else {
+                timer_ptr timer(new boost::asio::steady_timer(*io_service_ptr));
+                timer->expires_from_now(nanoseconds(it->time - exchange.command.time));
+                timer->async_wait([this, timer, hdl, response](const boost::system::error_code& ec) {
+                    if (!ec) {
+                        send(hdl, response);
+                    }
+                });
+            }
+        }
+    }
+
+    void send(connection_hdl hdl, const std::string& response) {
+        websocketpp::lib::error_code ec;
+        server.send(hdl, response, websocketpp::frame::opcode::text, ec);
+    }
+
+private:
+    boost::asio::io_service*         io_service_ptr;
+    const std::vector<SutExchange>&  exchanges;
+    sut_server                       server;
+    size_t                           next_exchange;
+    long                             n_unexpected;
+    bool                             fast;
+};
+
+// ----- replay of the messages from AMP
+
+class Replayer {
+public:
+    Replayer(boost::asio::io_service* io_service_ptr, const std::vector<SessionRecord>& records,
+             AdapterCore* adapter_core_ptr, SessionRecorder* output_ptr,
+             const std::string& sut_url, bool fast)
+        : io_service_ptr(io_service_ptr), records(records), adapter_core_ptr(adapter_core_ptr),
+          output_ptr(output_ptr), sut_url(sut_url), fast(fast), next_record(0),
+          n_expected(0), last_sent(0), n_injected(0), start_time(0), end_time(0),
+          progress_time(0), timer(*io_service_ptr) {
+    }
+
+    void start() {
+        start_time = LatencyRecorder::now();
+        progress_time = start_time;
+        adapter_core_ptr->on_open();
+        step();
+    }
+
+    long get_elapsed()    { return end_time - start_time; }
+    long get_n_injected() { return n_injected; }
+
+private:
+    // Inject the next message from AMP when it is due; wait for the
+    // adapter's messages to AMP at the end of the recording.
+    void step() {
+        while (next_record < records.size() &&
+               records[next_record].direction != FROM_AMP) {
+            if (records[next_record].direction == TO_AMP) {
+                n_expected++;
+            }
+            next_record++;
+        }
+
+        long now = LatencyRecorder::now();
+        uint64_t n_sent = output_ptr->get_count(TO_AMP);
+        if (n_sent != last_sent) {
+            last_sent = n_sent;
+            progress_time = now;
+        }
+        bool stalled = now - progress_time > STALL_TIMEOUT;
+
+        if (next_record == records.size()) {
+            if (n_sent >= n_expected || stalled) {
+                finish(stalled && n_sent < n_expected);
+            } else {
+                wait(100000);
+            }
+            return;
+        }
+
+        const SessionRecord& record = records[next_record];
+        if (fast) {
+            if (n_sent < n_expected && !stalled) {
+                io_service_ptr->post(std::bind(&Replayer::step, this));
+                return;
+            }
+        } else {
+            long due = start_time + (record.time - records.front().time);
+            if (due > now) {
+                wait(due - now);
+                return;
+            }
+        }
+
+        if (stalled) {
+            std::cerr << "replay: no response from the adapter, continuing" << std::endl;
+        }
+        inject(record);
+        next_record++;
+        progress_time = LatencyRecorder::now();
+        io_service_ptr->post(std::bind(&Replayer::step, this));
+    }
+
+    void wait(long ns) {
+        timer.expires_from_now(nanoseconds(ns));
+        timer.async_wait([this](const boost::system::error_code& ec) {
+            if (!ec) {
+                step();
+            }
+        });
+    }
+
+    // The configuration is redirected to the fake SUT.
+    void inject(const SessionRecord& record) {
+        std::string msg = payload_of(record);
+        Message message;
+        if (message.ParseFromString(msg) && message.has_configuration()) {
+            Configuration* configuration = message.mutable_configuration();
+            for (int i = 0; i < configuration->items_size(); i++) {
+                if (configuration->items(i).key() == "url") {
+                    configuration->mutable_items(i)->set_string(sut_url);
+                }
+            }
+            message.SerializeToString(&msg);
+        }
+        adapter_core_ptr->handle_message(msg, LatencyRecorder::now());
+        n_injected++;
+    }
+
+    void finish(bool incomplete) {
+        end_time = LatencyRecorder::now();
+        if (incomplete) {
+            std::cerr << "replay: the adapter did not send all expected messages" << std::endl;
+        }
+        io_service_ptr->stop();
+    }
+
+private:
+    boost::asio::io_service*           io_service_ptr;
+    const std::vector<SessionRecord>&  records;
+    AdapterCore*                       adapter_core_ptr;
+    SessionRecorder*                   output_ptr;
+    std::string                        sut_url;
+    bool                               fast;
+
+    size_t                             next_record;
+    uint64_t                           n_expected;  // messages to AMP so far
+    uint64_t                           last_sent;
+    long                               n_injected;
+    long                               start_time;
+    long                               end_time;
+    long                               progress_time;
+    boost::asio::steady_timer          timer;
+};
+
+// ----- comparison
+
+// Two messages to AMP match if they are of the same type and, for labels,
+// have the same name, type and channel.
+static bool same_message(const SessionRecord& expected, const SessionRecord& actual) {
+    Message expected_message;
+    Message actual_message;
+    expected_message.ParseFromArray(expected.payload, expected.length);
+    actual_message.ParseFromArray(actual.payload, actual.length);
+    if (expected_message.type_case() != actual_message.type_case()) {
+        return false;
+    }
+    if (!expected_message.has_label()) {
+        return true;
+    }
+    const Label& expected_label = expected_message.label();
+    const Label& actual_label = actual_message.label();
+    return expected_label.label() == actual_label.label() &&
+           expected_label.type() == actual_label.type() &&
+           expected_label.channel() == actual_label.channel();
+}
+
+static std::string describe(const SessionRecord& record) {
+    Message message;
+    message.ParseFromArray(record.payload, record.length);
+    if (message.has_label()) {
+        return "label " + message.label().label();
+    }
+    switch (message.type_case()) {
+    case Message::kAnnouncement:  return "announcement";
+    case Message::kConfiguration: return "configuration";
+    case Message::kReady:         return "ready";
+    case Message::kReset:         return "reset";
+    case Message::kError:         return "error: " + message.error().message();
+    default:                      return "unknown message";
+    }
+}
+
+static std::vector<SessionRecord> select(const std::vector<SessionRecord>& records,
+                                         RecordDirection direction) {
+    std::vector<SessionRecord> selection;
+    std::vector<SessionRecord>::const_iterator it;
+    for (it = records.begin(); it != records.end(); ++it) {
+        if (it->direction == direction) {
+            selection.push_back(*it);
+        }
+    }
+    return selection;
+}
+
+// Returns the number of mismatches; the first few are printed.
+static long compare(const std::vector<SessionRecord>& expected,
+                    const std::vector<SessionRecord>& actual) {
+    long n_mismatches = 0;
+    size_t n = std::max(expected.size(), actual.size());
+    for (size_t i = 0; i < n; i++) {
+        bool match = i < expected.size() && i < actual.size() &&
+                     same_message(expected[i], actual[i]);
+        if (!match) {
+            if (n_mismatches < 10) {
+                std::cout << "  mismatch at message " << i << " to AMP: expected "
+                          << (i < expected.size() ? describe(expected[i]) : "nothing")
+                          << ", got "
+                          << (i < actual.size() ? describe(actual[i]) : "nothing")
+                          << std::endl;
+            }
+            n_mismatches++;
+        }
+    }
+    return n_mismatches;
+}
+
+// ----- main
+
+static std::vector<SutExchange> sut_exchanges(const std::vector<SessionRecord>& records) {
+    std::vector<SutExchange> exchanges;
+    std::vector<SessionRecord>::const_iterator it;
+    for (it = records.begin(); it != records.end(); ++it) {
+        if (it->direction == TO_SUT) {
+            SutExchange exchange;
+            exchange.command = *it;
+            exchanges.push_back(exchange);
+        } else if (it->direction == FROM_SUT && !exchanges.empty()) {
+            exchanges.back().responses.push_back(*it);
+        }
+    }
+    return exchanges;
+}
+
+// An upper bound of the size of the recording.
+static size_t recorded_size(const std::vector<SessionRecord>& records) {
+    size_t size = SessionRecorder::HEADER_SIZE;
+    std::vector<SessionRecord>::const_iterator it;
+    for (it = records.begin(); it != records.end(); ++it) {
+        size += 24 + it->length;
+    }
+    return size;
+}
+
+static void usage() {
+    std::cerr << "usage: replay_session <recording> [--fast] [--port <sut port>] "
+              << "[--record <file>]" << std::endl;
+    exit(1);
+}
+
+static ReplayOptions parse_options(int argc, char* argv[]) {
+    ReplayOptions options;
+    options.fast = false;
+    options.sut_port = 3101;
+    if (argc < 2) {
+        usage();
+    }
+    options.recording = argv[1];
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--fast") {
+            options.fast = true;
+        } else if (arg == "--port" && i + 1 < argc) {
+            options.sut_port = std::atoi(argv[++i]);
+        } else if (arg == "--record" && i + 1 < argc) {
+            options.output = argv[++i];
+        } else {
+            usage();
+        }
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    ReplayOptions options = parse_options(argc, argv);
+
+    // The configuration of the recording is used: no pre-connect with the
+    // default configuration. The log of the adapter is silenced by default.
+    setenv("ADAPTER_PRECONNECT_SUT", "0", 0);
+    setenv("SPDLOG_LEVEL", "warn", 0);
+    axini::init_logging_from_env();
+
+    SessionReader reader(options.recording);
+    if (!reader.is_open()) {
+        return 1;
+    }
+    std::vector<SessionRecord> records;
+    SessionRecord record;
+    while (reader.next(&record)) {
+        records.push_back(record);
+    }
+    if (records.empty()) {
+        std::cerr << "replay: " << options.recording << " contains no messages" << std::endl;
+        return 1;
+    }
+    std::vector<SutExchange> exchanges = sut_exchanges(records);
+
+    boost::asio::io_service io_service;
+    std::string sut_url = "ws://localhost:" + std::to_string(options.sut_port);
+    FakeSut fake_sut(&io_service, exchanges, options.sut_port, options.fast);
+
+    SessionRecorder output(options.output, 2 * recorded_size(records) + (1 << 20));
+    SmartDoorHandler handler(sut_url, &io_service);
+    AdapterCore adapter_core("replay", 0, &handler);
+    StimulusPacer pacer(&io_service);
+    handler.register_adapter_core(&adapter_core);
+    adapter_core.register_pacer(&pacer);
+    adapter_core.register_recorder(&output);
+
+    Replayer replayer(&io_service, records, &adapter_core, &output, sut_url, options.fast);
+    io_service.post(std::bind(&Replayer::start, &replayer));
+    io_service.run();
+
+    handler.stop();
+    fake_sut.stop();
+
+    SessionReader replayed(output.get_data(), output.get_size());
+    std::vector<SessionRecord> replayed_records;
+    while (replayed.next(&record)) {
+        replayed_records.push_back(record);
+    }
+
+    long n_messages = replayer.get_n_injected() + (long) output.get_count(FROM_SUT);
+    double elapsed = replayer.get_elapsed() / 1e9;
+    double original = (records.back().time - records.front().time) / 1e9;
+
+    std::cout << "recording:          " << options.recording << " ("
+              << records.size() << " messages, " << original << " s)" << std::endl;
+    std::cout << "mode:               " << (options.fast ? "as fast as possible"
+                                                         : "original timing") << std::endl;
+    std::cout << "messages from AMP:  " << replayer.get_n_injected() << std::endl;
+    std::cout << "messages to AMP:    " << output.get_count(TO_AMP) << " (recorded: "
+              << select(records, TO_AMP).size() << ")" << std::endl;
+    std::cout << "commands to SUT:    " << fake_sut.get_n_commands() << " (recorded: "
+              << exchanges.size() << ", unexpected: " << fake_sut.get_n_unexpected()
+              << ")" << std::endl;
+    std::cout << "elapsed:            " << elapsed << " s" << std::endl;
+    std::cout << "messages/sec:       " << (elapsed > 0 ? n_messages / elapsed : 0) << std::endl;
+
+    long n_mismatches = compare(select(records, TO_AMP), select(replayed_records, TO_AMP));
+    std::cout << "mismatches:         " << n_mismatches << std::endl;
+
+    adapter_core.dump_latencies();
+    google::protobuf::ShutdownProtobufLibrary();
+    spdlog::shutdown();
+    return n_mismatches == 0 ? 0 : 2;
+}
@@ -1,16 +1,41 @@
 // Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
 
+#include <chrono>
+#include <cstdio>
+
 #include "spdlog/spdlog.h"
 #include "broker_connection.hpp"
 #include "adapter_core.hpp"
+#include "latency_histogram.hpp"
+#include "env.hpp"
 
 using websocketpp::lib::bind;
 using websocketpp::lib::placeholders::_1;
 using websocketpp::lib::placeholders::_2;
 
-BrokerConnection::BrokerConnection(std::string uri, std::string token)
+// WebSocket++ does not report completed writes: while the buffered amount is
+// above the high water mark, it is polled with this interval.
+static const long DRAIN_POLL_INTERVAL = 1; // milliseconds
+
+BrokerConnection::BrokerConnection(std::string uri, std::string token,
+                                   websocketpp::lib::asio::io_service* io_service_ptr)
     : server_uri(uri)
-    , amp_token(token) {
+    , amp_token(token)
+    , pending_bytes(0)
+    , flush_scheduled(false)
+    , reading_paused(false)
+    , n_writes(0)
+    , n_frames(0)
+    , max_frames_per_write(0)
+    , deflate_negotiated(false)
+    , n_deflated(0)
+    , deflated_bytes(0)
+    , deflated_wire_bytes(0)
+    , deflate_time(0)
+    , n_plain(0)
+    , plain_time(0) {
+
+    flush_delay = axini::env_long("ADAPTER_FLUSH_DELAY_US", 0);
 
     // WebSocket++ logging: pretty verbose (everything except message payloads).
     // m_endpoint.set_access_channels(websocketpp::log::alevel::all);
@@ -22,20 +47,39 @@ BrokerConnection::BrokerConnection(std::string uri, std::string token)
     m_endpoint.clear_access_channels(websocketpp::log::alevel::none);
     m_endpoint.set_error_channels(websocketpp::log::elevel::none);
 
+    // Register the callback handlers. They are guarded: on an external
+    // io_service, they may be called after this object has been deleted.
+    // The TLS init handler is called by connect(), on the caller's thread.
+    m_endpoint.set_socket_init_handler(lifetime_guard.wrap(
+        bind(&BrokerConnection::on_socket_init,this,::_1)));
+    m_endpoint.set_tls_init_handler(bind(&BrokerConnection::on_tls_init,this,::_1));
+    m_endpoint.set_open_handler(lifetime_guard.wrap(
+        bind(&BrokerConnection::on_open,this,::_1)));
+    m_endpoint.set_close_handler(lifetime_guard.wrap(
+        bind(&BrokerConnection::on_close,this,::_1)));
+    m_endpoint.set_fail_handler(lifetime_guard.wrap(
+        bind(&BrokerConnection::on_fail,this,::_1)));
+    m_endpoint.set_message_handler(lifetime_guard.wrap(
+        bind(&BrokerConnection::on_message,this,::_1,::_2)));
+
+    if (io_service_ptr != 0) {
+        // Attach to the external io_service; its owner runs the event loop.
+        m_endpoint.init_asio(io_service_ptr);
+        flush_timer = websocketpp::lib::make_shared<timer>(*io_service_ptr);
+        reconnect_timer = websocketpp::lib::make_shared<timer>(*io_service_ptr);
+        drain_timer = websocketpp::lib::make_shared<timer>(*io_service_ptr);
+        return;
+    }
+
     // Initialize ASIO.
     m_endpoint.init_asio();
+    flush_timer = websocketpp::lib::make_shared<timer>(m_endpoint.get_io_service());
+    reconnect_timer = websocketpp::lib::make_shared<timer>(m_endpoint.get_io_service());
+    drain_timer = websocketpp::lib::make_shared<timer>(m_endpoint.get_io_service());
 
     // Marks the endpoint as perpetual, stopping it from exiting when empty.
     m_endpoint.start_perpetual();
 
-    // Register the callback handlers.
-    m_endpoint.set_socket_init_handler(bind(&BrokerConnection::on_socket_init,this,::_1));
-    m_endpoint.set_tls_init_handler(bind(&BrokerConnection::on_tls_init,this,::_1));
-    m_endpoint.set_open_handler(bind(&BrokerConnection::on_open,this,::_1));
-    m_endpoint.set_close_handler(bind(&BrokerConnection::on_close,this,::_1));
-    m_endpoint.set_fail_handler(bind(&BrokerConnection::on_fail,this,::_1));
-    m_endpoint.set_message_handler(bind(&BrokerConnection::on_message,this,::_1,::_2));
-
     // Start a thread in the background which calls run.
     // This will start the ASIO io_service run loop. This will cause a single connection
     // to be made to the server. c.run() will exit when the connection is closed.
@@ -46,22 +90,49 @@ BrokerConnection::BrokerConnection(std::string uri, std::string token)
 BrokerConnection::~BrokerConnection() {
     // A BrokerConnection does not "own" the AdapterCore, so we should *not* delete it.
 
-    m_endpoint.stop_perpetual();
-
+    if (m_thread) {
+        m_endpoint.stop_perpetual();
+    } else {
+        // The event loop outlives this object: wait for a callback (or posted
+        // flush) which is running on another thread, and drop the ones which
+        // are still to come.
+        lifetime_guard.invalidate();
+    }
+    flush_timer->cancel();
+    reconnect_timer->cancel();
+    drain_timer->cancel();
+
+    websocketpp::connection_hdl hdl;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        hdl = m_hdl;
+    }
     websocketpp::lib::error_code ec;
-    m_endpoint.close(m_hdl, websocketpp::close::status::going_away, "", ec);
+    m_endpoint.close(hdl, websocketpp::close::status::going_away, "", ec);
     if (ec) {
         spdlog::error("BrokerConnection: error closing connection: " + ec.message());
     }
 
-    m_thread->join();
+    if (m_thread) {
+        m_thread->join();
+    }
 }
 
+// The frames which are still queued (e.g. an Error) are written before the
+// close frame; a posted flush would find the connection closed.
 void BrokerConnection::close(int code, std::string message) {
     spdlog::info("BrokerConnection::close");
 
+    websocketpp::connection_hdl hdl;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        flush_timer->cancel();
+        write_pending_frames();
+        hdl = m_hdl;
+    }
+
     websocketpp::lib::error_code ec;
-    m_endpoint.close(m_hdl, code, message, ec);
+    m_endpoint.close(hdl, code, message, ec);
     if (ec) {
         spdlog::error("BrokerConnection: error closing connection: " + ec.message());
     }
@@ -79,26 +150,63 @@ void BrokerConnection::connect() {
     }
 
     con->append_header("Authorization", "Bearer " + amp_token);
-    m_hdl = con->get_handle();
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        m_hdl = con->get_handle();
+        reading_paused = false;
+    }
     m_endpoint.connect(con);
 }
 
+// Connect after a delay, on the event loop of the connection.
+void BrokerConnection::connect_after(long milliseconds) {
+    if (milliseconds <= 0) {
+        connect();
+        return;
+    }
+
+    reconnect_timer->expires_from_now(std::chrono::milliseconds(milliseconds));
+    reconnect_timer->async_wait(lifetime_guard.wrap(
+        [this](const websocketpp::lib::error_code& ec) {
+            if (!ec) {
+                connect();
+            }
+        }));
+}
+
+// Called before the TLS handshake: offer the session of the last connection.
 void BrokerConnection::on_socket_init(connection_hdl hdl) {
     spdlog::info("BrokerConnection::on_socket_init");
+    connection_ptr con = m_endpoint.get_con_from_hdl(hdl);
+    tls_context.prepare(con->get_socket().native_handle());
 }
 
-// TLS init handler. Do nothing special.
+// TLS init handler. All connection attempts share the same TLS context.
 // See print_client_tls.cpp for more advanced TLS handling.
 context_ptr BrokerConnection::on_tls_init(connection_hdl hdl) {
-    context_ptr ctx = websocketpp::lib::make_shared<boost::asio::ssl::context>(
-        boost::asio::ssl::context::sslv23);
-    ctx -> set_default_verify_paths();
-    return ctx;
+    return tls_context.get_context();
 }
 
 void BrokerConnection::on_open(connection_hdl hdl) {
     spdlog::info("BrokerConnection::on_open");
     spdlog::info("BrokerConnection: connected to AMP: " + server_uri);
+    char line[128];
+    snprintf(line, sizeof(line), "BrokerConnection: TLS handshake %s in %.2f ms",
+             tls_context.was_last_handshake_resumed() ? "resumed" : "completed",
+             tls_context.get_last_handshake_time() / 1e6);
+    spdlog::info(line);
+
+    connection_ptr con = m_endpoint.get_con_from_hdl(hdl);
+    std::string extensions = con->get_response_header("Sec-WebSocket-Extensions");
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        deflate_negotiated = extensions.find("permessage-deflate") != std::string::npos;
+    }
+    if (deflate_options().enabled) {
+        spdlog::info("BrokerConnection: permessage-deflate " +
+                     std::string(deflate_negotiated ? "accepted: " + extensions
+                                                    : "not accepted by AMP"));
+    }
     adapter_core_ptr->on_open();
 }
 
@@ -115,18 +223,32 @@ void BrokerConnection::on_close(connection_hdl hdl) {
       << "close reason: " << reason << "." ;
     spdlog::info("BrokerConnection: " + s.str());
 
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        water_marks.clear(LatencyRecorder::now());
+    }
+    drain_timer->cancel();
     adapter_core_ptr->on_close(code, reason);
 }
 
+// The connection could not be established. For the AdapterCore this is the
+// same as an abnormal close of the connection: it will try again.
 void BrokerConnection::on_fail(connection_hdl hdl) {
     spdlog::error("BrokerConnection::on_fail");
     connection_ptr con = m_endpoint.get_con_from_hdl(hdl);
     std::string msg = con->get_ec().message();
     spdlog::error("Error message: " + msg);
+
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        water_marks.clear(LatencyRecorder::now());
+    }
+    drain_timer->cancel();
+    adapter_core_ptr->on_close(websocketpp::close::status::abnormal_close, msg);
 }
 
 void BrokerConnection::on_message(connection_hdl hdl, message_ptr msg) {
-    spdlog::info("BrokerConnection::on_message");
+    SPDLOG_DEBUG("BrokerConnection::on_message");
 
     if (msg->get_opcode() == websocketpp::frame::opcode::text) {
         std::stringstream s;
@@ -134,29 +256,241 @@ void BrokerConnection::on_message(connection_hdl hdl, message_ptr msg) {
           << "text message received from AMP: " + msg->get_payload();
         spdlog::error(s.str());
     } else {
-        adapter_core_ptr->handle_message(msg->get_payload());
+        adapter_core_ptr->handle_message(msg->get_payload(), LatencyRecorder::now());
     }
 }
 
 void BrokerConnection::send(std::string message) {
+    queue_frame(websocketpp::frame::opcode::text, message.c_str(), message.size());
+}
+
+void BrokerConnection::send(void const * payload, size_t len) {
+    queue_frame(websocketpp::frame::opcode::binary, payload, len);
+}
+
+void BrokerConnection::set_flush_delay(long microseconds) {
+    std::lock_guard<std::mutex> lock(send_mutex);
+    flush_delay = microseconds;
+}
+
+// The payload is copied into a WebSocket++ message right away. The first
+// frame of a batch schedules the flush on the event loop.
+void BrokerConnection::queue_frame(websocketpp::frame::opcode::value opcode,
+                                   void const * payload, size_t len) {
+    websocketpp::connection_hdl hdl;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        hdl = m_hdl;
+    }
     websocketpp::lib::error_code ec;
-    m_endpoint.send(m_hdl, message, websocketpp::frame::opcode::text, ec);
+    connection_ptr con = m_endpoint.get_con_from_hdl(hdl, ec);
     if (ec) {
         spdlog::error("BrokerConnection: error sending message: " + ec.message());
         return;
     }
+    message_ptr msg = con->get_message(opcode, len);
+    msg->append_payload(payload, len);
+    msg->set_compressed(len >= deflate_options().min_size);
+
+    std::lock_guard<std::mutex> lock(send_mutex);
+    pending_frames.push_back(msg);
+    pending_bytes += len;
+    if (flush_scheduled) {
+        return;
+    }
+    flush_scheduled = true;
+
+    if (flush_delay > 0) {
+        flush_timer->expires_from_now(std::chrono::microseconds(flush_delay));
+        flush_timer->async_wait(lifetime_guard.wrap(
+            [this](const websocketpp::lib::error_code& ec) {
+                if (!ec) {
+                    flush();
+                }
+            }));
+    } else {
+        m_endpoint.get_io_service().post(
+            lifetime_guard.wrap(bind(&BrokerConnection::flush, this)));
+    }
 }
 
-void BrokerConnection::send(void const * payload, size_t len) {
-    websocketpp::lib::error_code ec;
+void BrokerConnection::flush() {
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        write_pending_frames();
+    }
+    check_water_marks();
+}
+
+// Hand all pending frames to WebSocket++ at once: they end up in its send
+// queue before its write handler runs, which writes them all in one go.
+// The frames are handed over while holding the send_mutex, so that a next
+// flush (possibly on another thread) cannot overtake this one. The send_mutex
+// must be held.
+void BrokerConnection::write_pending_frames() {
+    flush_scheduled = false;
+    if (pending_frames.empty()) {
+        return;
+    }
+
+    if (deflate_negotiated) {
+        websocketpp::lib::error_code ec;
+        connection_ptr con = m_endpoint.get_con_from_hdl(m_hdl, ec);
+        if (!ec) {
+            for (message_ptr& msg : pending_frames) {
+                write_measured_frame(con, msg);
+            }
+        }
+    } else {
+        for (message_ptr& msg : pending_frames) {
+            websocketpp::lib::error_code ec;
+            m_endpoint.send(m_hdl, msg, ec);
+            if (ec) {
+                spdlog::error("BrokerConnection: error sending message: " + ec.message());
+            }
+        }
+    }
+
+    n_writes++;
+    n_frames += pending_frames.size();
+    if (pending_frames.size() > max_frames_per_write) {
+        max_frames_per_write = pending_frames.size();
+    }
+    pending_frames.clear();
+    pending_bytes = 0;
+}
 
-    m_endpoint.send(m_hdl, payload, len, websocketpp::frame::opcode::binary, ec);
+// WebSocket++ compresses the message in send, and adds the compressed payload
+// to its buffered amount. The send_mutex must be held.
+void BrokerConnection::write_measured_frame(connection_ptr con, message_ptr msg) {
+    size_t buffered = con->get_buffered_amount();
+    long start_time = LatencyRecorder::now();
+    websocketpp::lib::error_code ec = con->send(msg);
+    long time = LatencyRecorder::now() - start_time;
     if (ec) {
         spdlog::error("BrokerConnection: error sending message: " + ec.message());
         return;
     }
+
+    if (!msg->get_compressed()) {
+        n_plain++;
+        plain_time += time;
+        return;
+    }
+    n_deflated++;
+    deflate_time += time;
+    // The buffered amount may also have dropped by a write on another thread;
+    // the sample is then only counted for the time.
+    size_t now_buffered = con->get_buffered_amount();
+    if (now_buffered > buffered) {
+        deflated_bytes += msg->get_payload().size();
+        deflated_wire_bytes += now_buffered - buffered;
+    }
+}
+
+// Called on the event loop, after a flush and while draining. The AdapterCore
+// is told about a crossing of a water mark outside of the lock.
+void BrokerConnection::check_water_marks() {
+    WaterMarks::Crossing crossing;
+    bool high;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        crossing = water_marks.update(buffered_amount(), LatencyRecorder::now());
+        high = water_marks.is_high();
+    }
+
+    if (crossing == WaterMarks::HIGH_CROSSING) {
+        spdlog::warn("BrokerConnection: above the high water mark, AMP does not keep up");
+        adapter_core_ptr->on_amp_backpressure(true);
+    } else if (crossing == WaterMarks::LOW_CROSSING) {
+        spdlog::info("BrokerConnection: drained to the low water mark");
+        adapter_core_ptr->on_amp_backpressure(false);
+    }
+
+    if (high) {
+        drain_timer->expires_from_now(std::chrono::milliseconds(DRAIN_POLL_INTERVAL));
+        drain_timer->async_wait(lifetime_guard.wrap(
+            [this](const websocketpp::lib::error_code& ec) {
+                if (!ec) {
+                    check_water_marks();
+                }
+            }));
+    }
+}
+
+size_t BrokerConnection::get_buffered_amount() {
+    std::lock_guard<std::mutex> lock(send_mutex);
+    return buffered_amount();
+}
+
+// The send_mutex must be held.
+size_t BrokerConnection::buffered_amount() {
+    websocketpp::lib::error_code ec;
+    connection_ptr con = m_endpoint.get_con_from_hdl(m_hdl, ec);
+    if (ec) {
+        return pending_bytes;
+    }
+    return pending_bytes + con->get_buffered_amount();
+}
+
+// WebSocket++ must not be asked to resume reading a connection which is not
+// paused: it would start a second read.
+void BrokerConnection::pause_reading() {
+    std::lock_guard<std::mutex> lock(send_mutex);
+    if (reading_paused) {
+        return;
+    }
+
+    websocketpp::lib::error_code ec;
+    m_endpoint.pause_reading(m_hdl, ec);
+    if (ec) {
+        spdlog::error("BrokerConnection: error pausing reading: " + ec.message());
+        return;
+    }
+    reading_paused = true;
+}
+
+void BrokerConnection::resume_reading() {
+    std::lock_guard<std::mutex> lock(send_mutex);
+    if (!reading_paused) {
+        return;
+    }
+
+    reading_paused = false;
+    websocketpp::lib::error_code ec;
+    m_endpoint.resume_reading(m_hdl, ec);
+    if (ec) {
+        spdlog::error("BrokerConnection: error resuming reading: " + ec.message());
+    }
+}
+
+void BrokerConnection::dump_write_statistics() {
+    std::lock_guard<std::mutex> lock(send_mutex);
+    char line[256];
+    snprintf(line, sizeof(line),
+        "BrokerConnection: %lu frames in %lu writes (%.2f frames/write, max %lu), "
+        "flush delay %ld us",
+        n_frames, n_writes, (n_writes > 0) ? (double) n_frames / n_writes : 0.0,
+        max_frames_per_write, flush_delay);
+    spdlog::info(line);
+    water_marks.dump_statistics("BrokerConnection");
+    tls_context.dump_statistics("BrokerConnection");
+
+    if (deflate_negotiated || n_deflated > 0) {
+        snprintf(line, sizeof(line),
+            "BrokerConnection: permessage-deflate: %lu messages compressed (ratio %.2f: "
+            "%lu -> %lu bytes), %.0f ns/message; %lu messages below %lu bytes, %.0f ns/message",
+            n_deflated,
+            (deflated_wire_bytes > 0) ? (double) deflated_bytes / deflated_wire_bytes : 0.0,
+            deflated_bytes, deflated_wire_bytes,
+            (n_deflated > 0) ? (double) deflate_time / n_deflated : 0.0,
+            n_plain, (unsigned long) deflate_options().min_size,
+            (n_plain > 0) ? (double) plain_time / n_plain : 0.0);
+        spdlog::info(line);
+    }
 }
 
+// Returns an empty pointer when the BrokerConnection runs on an external io_service.
 websocketpp::lib::shared_ptr<websocketpp::lib::thread> BrokerConnection::get_thread() {
     return m_thread;
 }
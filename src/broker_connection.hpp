@@ -3,14 +3,32 @@
 #ifndef BROKER_CONNECTION_HPP
 #define BROKER_CONNECTION_HPP
 
+#include <mutex>
 #include <string>
+#include <vector>
+
 #include <websocketpp/config/asio_client.hpp>
 #include <websocketpp/client.hpp>
 
 #include <websocketpp/common/thread.hpp>
 #include <websocketpp/common/memory.hpp>
 
-typedef websocketpp::client<websocketpp::config::asio_tls_client> client;
+#include "deflate_extension.hpp"
+#include "lifetime_guard.hpp"
+#include "tls_client_context.hpp"
+#include "water_marks.hpp"
+
+// The TLS client configuration of WebSocket++, with the permessage-deflate
+// extension (see deflate_extension.hpp).
+struct deflate_tls_client : public websocketpp::config::asio_tls_client {
+    typedef deflate_tls_client                 type;
+    typedef websocketpp::config::asio_tls_client base;
+
+    struct permessage_deflate_config {};
+    typedef DeflateExtension<permessage_deflate_config> permessage_deflate_type;
+};
+
+typedef websocketpp::client<deflate_tls_client> client;
 typedef websocketpp::lib::shared_ptr<websocketpp::lib::asio::ssl::context> context_ptr;
 typedef websocketpp::config::asio_tls_client::message_type::ptr message_ptr;
 typedef websocketpp::connection_hdl connection_hdl;
@@ -19,16 +37,52 @@ typedef client::connection_ptr connection_ptr;
 class AdapterCore;
 
 // The BrokerConnection is responsible for the WebSocket connection to AMP.
+// If no io_service is given, the BrokerConnection runs its own ASIO event loop
+// in a background thread. Otherwise, it attaches to the given io_service,
+// which is owned and run by the caller.
+//
+// Outgoing frames are not written one by one. The frames sent during one turn
+// of the event loop (or during the flush delay, if set) are queued and handed
+// to WebSocket++ together, which writes them to the socket with a single
+// gathered write. The order of the frames is preserved.
+//
+// The bytes which are queued for AMP (pending frames and WebSocket++'s send
+// buffer) are bounded by WaterMarks: when the buffered amount rises to the
+// high water mark, the AdapterCore is told to stop reading from the SUT until
+// it has drained to the low water mark.
+//
+// If AMP accepts the permessage-deflate extension, the messages of at least
+// the minimum size are compressed. The compression ratio and the CPU time of
+// handing a message to WebSocket++ (which compresses it) are kept, for the
+// compressed and for the uncompressed messages.
+//
+// The TLS context is built once and shared by all connection attempts; a
+// reconnect resumes the TLS session of the previous connection.
 class BrokerConnection {
 public:
-    BrokerConnection(std::string uri, std::string token);
+    BrokerConnection(std::string uri, std::string token,
+                     websocketpp::lib::asio::io_service* io_service_ptr = 0);
     ~BrokerConnection();
 
     void connect();
+    void connect_after(long milliseconds);
     void close(int, std::string);
     void send(std::string message);
     void send(void const * payload, size_t len);
 
+    // With a flush delay of 0, frames are written at the end of the current
+    // turn of the event loop. A larger delay trades latency for larger writes.
+    void set_flush_delay(long microseconds);
+    void dump_write_statistics();
+
+    // The number of bytes queued for AMP, but not yet written to the socket.
+    size_t get_buffered_amount();
+
+    // Stop (and continue) reading messages from AMP, e.g. while the SUT does
+    // not keep up with the stimuli.
+    void pause_reading();
+    void resume_reading();
+
     websocketpp::lib::shared_ptr<websocketpp::lib::thread> get_thread();
     void register_adapter_core(AdapterCore* adapter_core_ptr);
 
@@ -41,14 +95,50 @@ private:
     void on_fail(connection_hdl hdl);
     void on_message(connection_hdl hdl, message_ptr msg);
 
+    void queue_frame(websocketpp::frame::opcode::value opcode,
+                     void const * payload, size_t len);
+    void flush();
+    void write_pending_frames();
+    void write_measured_frame(connection_ptr con, message_ptr msg);
+    void check_water_marks();
+    size_t buffered_amount();
+
 private:
     client m_endpoint;
-    websocketpp::connection_hdl m_hdl;
+    websocketpp::connection_hdl m_hdl;  // guarded by send_mutex
     websocketpp::lib::shared_ptr<websocketpp::lib::thread> m_thread;
 
     AdapterCore* adapter_core_ptr;
     std::string server_uri;
     std::string amp_token;
+
+    typedef websocketpp::lib::asio::steady_timer timer;
+
+    std::mutex                             send_mutex;
+    std::vector<message_ptr>               pending_frames;
+    size_t                                 pending_bytes;
+    bool                                   flush_scheduled;
+    long                                   flush_delay;  // microseconds
+    websocketpp::lib::shared_ptr<timer>    flush_timer;
+    websocketpp::lib::shared_ptr<timer>    reconnect_timer;
+    websocketpp::lib::shared_ptr<timer>    drain_timer;
+
+    TlsClientContext                       tls_context;
+    WaterMarks                             water_marks;
+    LifetimeGuard                          lifetime_guard;  // of the callbacks run by the event loop
+    bool                                   reading_paused;
+
+    unsigned long                          n_writes;
+    unsigned long                          n_frames;
+    unsigned long                          max_frames_per_write;
+
+    bool                                   deflate_negotiated;
+    unsigned long                          n_deflated;
+    unsigned long                          deflated_bytes;      // before compression
+    unsigned long                          deflated_wire_bytes; // ... after
+    long                                   deflate_time;        // nanoseconds
+    unsigned long                          n_plain;
+    long                                   plain_time;
 };
 
 #endif // BROKER_CONNECTION_HPP
@@ -0,0 +1,56 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <time.h>
+
+#include "clock.hpp"
+
+#ifdef CLOCK_MONOTONIC_RAW
+static const clockid_t MONOTONIC_CLOCK = CLOCK_MONOTONIC_RAW;
+#else
+static const clockid_t MONOTONIC_CLOCK = CLOCK_MONOTONIC;
+#endif
+
+static long read_clock(clockid_t clock_id) {
+    struct timespec ts;
+    clock_gettime(clock_id, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// The real-time clock is read between two readings of the monotonic clock.
+// The narrowest of a few attempts gives the most accurate offset.
+static long measure_epoch_offset() {
+    long best_width = -1;
+    long offset = 0;
+    for (int i = 0; i < 5; i++) {
+        long before = read_clock(MONOTONIC_CLOCK);
+        long realtime = read_clock(CLOCK_REALTIME);
+        long after = read_clock(MONOTONIC_CLOCK);
+        if (best_width < 0 || after - before < best_width) {
+            best_width = after - before;
+            offset = realtime - (before + (after - before) / 2);
+        }
+    }
+    return offset;
+}
+
+// The offset is measured on first use (thread-safe since C++11).
+static long epoch_offset() {
+    static const long offset = measure_epoch_offset();
+    return offset;
+}
+
+long axini::monotonic_now() {
+    return read_clock(MONOTONIC_CLOCK);
+}
+
+long axini::to_epoch_nanoseconds(long monotonic_time) {
+    return monotonic_time + epoch_offset();
+}
+
+long axini::clock_drift() {
+    long offset = epoch_offset();
+    long before = read_clock(MONOTONIC_CLOCK);
+    long realtime = read_clock(CLOCK_REALTIME);
+    long after = read_clock(MONOTONIC_CLOCK);
+    return realtime - (before + (after - before) / 2 + offset);
+}
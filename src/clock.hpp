@@ -0,0 +1,29 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+// The clock of the adapter. Times are taken once, when a message is received
+// from or written to a socket, and are carried with the message. The same
+// reading is used both for the latencies and for the timestamps of the labels.
+//
+// * Times are read from a monotonic clock which is not adjusted by NTP
+//   (CLOCK_MONOTONIC_RAW where available), which is cheap to read.
+// * The offset between the monotonic clock and the real-time clock is measured
+//   once, so a monotonic time can be converted to nanoseconds since the epoch
+//   without reading the real-time clock again.
+
+namespace axini {
+    // Monotonic time in nanoseconds.
+    long monotonic_now();
+
+    // Convert a monotonic time to nanoseconds since the epoch.
+    long to_epoch_nanoseconds(long monotonic_time);
+
+    // The current difference in nanoseconds between the real-time clock and
+    // the anchored monotonic clock, i.e. how far the clocks have drifted apart
+    // since the anchor was taken (including NTP adjustments).
+    long clock_drift();
+}
+
+#endif // CLOCK_HPP
@@ -0,0 +1,128 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <mutex>
+#include <unordered_map>
+
+#include "configuration_snapshot.hpp"
+
+static const std::string EMPTY_STRING;
+
+// The table of interned keys is created on first use, so that keys can be
+// static constants in any translation unit. Only the keys of the adapter,
+// its ConfigurationKey constants, are interned: not the keys sent by AMP.
+static std::mutex& key_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::unordered_map<std::string, size_t>& key_ids() {
+    static std::unordered_map<std::string, size_t> ids;
+    return ids;
+}
+
+static size_t intern(const std::string& name) {
+    std::lock_guard<std::mutex> lock(key_mutex());
+    std::unordered_map<std::string, size_t>& ids = key_ids();
+    std::unordered_map<std::string, size_t>::iterator it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    size_t id = ids.size();
+    ids[name] = id;
+    return id;
+}
+
+// Returns false if the name is not the key of a ConfigurationKey.
+static bool lookup(const std::string& name, size_t* id_ptr) {
+    std::lock_guard<std::mutex> lock(key_mutex());
+    std::unordered_map<std::string, size_t>& ids = key_ids();
+    std::unordered_map<std::string, size_t>::iterator it = ids.find(name);
+    if (it == ids.end()) {
+        return false;
+    }
+    *id_ptr = it->second;
+    return true;
+}
+
+// ----- ConfigurationKey
+
+ConfigurationKey::ConfigurationKey(const std::string& name)
+    : id(intern(name)),
+      name(name) {
+}
+
+size_t ConfigurationKey::get_id() const {
+    return id;
+}
+
+const std::string& ConfigurationKey::get_name() const {
+    return name;
+}
+
+// ----- ConfigurationSnapshot
+
+ConfigurationSnapshot::ConfigurationSnapshot(const Configuration& configuration)
+    : configuration(configuration) {
+    for (int i = 0; i < configuration.items_size(); i++) {
+        const Configuration_Item& item = configuration.items(i);
+        size_t id;
+        if (!lookup(item.key(), &id)) {
+            continue;
+        }
+        if (id >= values.size()) {
+            Value missing;
+            missing.type = Configuration_Item::TYPE_NOT_SET;
+            values.resize(id + 1, missing);
+        }
+
+        // The first item with the key wins, as with axini::get_string_value_from.
+        Value& value = values[id];
+        if (value.type != Configuration_Item::TYPE_NOT_SET) {
+            continue;
+        }
+        value.type = item.type_case();
+        value.string_value = item.has_string() ? item.string() : "";
+        value.integer_value = item.has_integer() ? item.integer() : 0;
+        value.float_value = item.has_float_() ? item.float_() : 0.0f;
+        value.boolean_value = item.has_boolean() ? item.boolean() : false;
+    }
+}
+
+// A key that was interned after the snapshot was built is not in it.
+const ConfigurationSnapshot::Value* ConfigurationSnapshot::find(
+        const ConfigurationKey& key, Configuration_Item::TypeCase type) const {
+    size_t id = key.get_id();
+    if (id >= values.size() || values[id].type != type) {
+        return 0;
+    }
+    return &values[id];
+}
+
+bool ConfigurationSnapshot::has(const ConfigurationKey& key) const {
+    size_t id = key.get_id();
+    return id < values.size() && values[id].type != Configuration_Item::TYPE_NOT_SET;
+}
+
+const std::string& ConfigurationSnapshot::get_string(const ConfigurationKey& key) const {
+    const Value* value_ptr = find(key, Configuration_Item::kString);
+    return value_ptr != 0 ? value_ptr->string_value : EMPTY_STRING;
+}
+
+long ConfigurationSnapshot::get_integer(const ConfigurationKey& key) const {
+    const Value* value_ptr = find(key, Configuration_Item::kInteger);
+    return value_ptr != 0 ? value_ptr->integer_value : 0;
+}
+
+float ConfigurationSnapshot::get_float(const ConfigurationKey& key) const {
+    const Value* value_ptr = find(key, Configuration_Item::kFloat);
+    return value_ptr != 0 ? value_ptr->float_value : 0.0f;
+}
+
+bool ConfigurationSnapshot::get_boolean(const ConfigurationKey& key) const {
+    const Value* value_ptr = find(key, Configuration_Item::kBoolean);
+    return value_ptr != 0 ? value_ptr->boolean_value : false;
+}
+
+const Configuration& ConfigurationSnapshot::get_configuration() const {
+    return configuration;
+}
@@ -0,0 +1,66 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef CONFIGURATION_SNAPSHOT_HPP
+#define CONFIGURATION_SNAPSHOT_HPP
+
+#include <string>
+#include <vector>
+
+#include "pa_protobuf.hpp"
+using namespace PluginAdapter::Api;
+
+// A ConfigurationKey is an interned key of a configuration item: every
+// distinct key name gets a small, process-wide unique id. Keys are meant to
+// be created once (e.g. as static constants), as interning takes a lock.
+class ConfigurationKey {
+public:
+    explicit ConfigurationKey(const std::string& name);
+
+    size_t get_id() const;
+    const std::string& get_name() const;
+
+private:
+    size_t       id;
+    std::string  name;
+};
+
+// A ConfigurationSnapshot is an immutable, typed view of a Configuration.
+// The values are stored by the id of their key, so a lookup is an index
+// into a vector: O(1), without string compares and without allocations.
+//
+// Only the items of which the key is a ConfigurationKey are stored; the
+// others are only in the configuration. If a key occurs more than once, the
+// first item is used.
+//
+// The accessors return a default value (empty string, 0, false) if the item
+// is missing or has another type, as axini::get_string_value_from does.
+class ConfigurationSnapshot {
+public:
+    ConfigurationSnapshot(const Configuration& configuration);
+
+    bool has(const ConfigurationKey& key) const;
+
+    const std::string& get_string(const ConfigurationKey& key) const;
+    long get_integer(const ConfigurationKey& key) const;
+    float get_float(const ConfigurationKey& key) const;
+    bool get_boolean(const ConfigurationKey& key) const;
+
+    // The configuration from which the snapshot was built.
+    const Configuration& get_configuration() const;
+
+private:
+    struct Value {
+        Configuration_Item::TypeCase  type;
+        std::string                   string_value;
+        long                          integer_value;
+        float                         float_value;
+        bool                          boolean_value;
+    };
+
+    const Value* find(const ConfigurationKey& key, Configuration_Item::TypeCase type) const;
+
+    Configuration       configuration;
+    std::vector<Value>  values;  // indexed by the id of the key
+};
+
+#endif // CONFIGURATION_SNAPSHOT_HPP
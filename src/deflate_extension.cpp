@@ -0,0 +1,18 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include "deflate_extension.hpp"
+#include "env.hpp"
+
+static DeflateOptions read_deflate_options() {
+    DeflateOptions options;
+    options.enabled = axini::env_long("ADAPTER_DEFLATE", 0) != 0;
+    long min_size = axini::env_long("ADAPTER_DEFLATE_MIN_BYTES", 256);
+    options.min_size = (min_size > 0) ? min_size : 0;
+    options.context_takeover = axini::env_long("ADAPTER_DEFLATE_CONTEXT_TAKEOVER", 1) != 0;
+    return options;
+}
+
+const DeflateOptions& deflate_options() {
+    static const DeflateOptions options = read_deflate_options();
+    return options;
+}
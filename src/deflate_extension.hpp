@@ -0,0 +1,52 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef DEFLATE_EXTENSION_HPP
+#define DEFLATE_EXTENSION_HPP
+
+#include <cstddef>
+#include <string>
+
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+
+// The options of the permessage-deflate extension (RFC 7692) on the
+// connection with AMP, read once from the environment variables
+// ADAPTER_DEFLATE (default: 0, no compression), ADAPTER_DEFLATE_MIN_BYTES
+// (default: 256; smaller messages are sent uncompressed) and
+// ADAPTER_DEFLATE_CONTEXT_TAKEOVER (default: 1; with 0, both sides reset
+// their compression context after every message, which costs ratio but
+// saves the memory of the context between messages).
+struct DeflateOptions {
+    bool    enabled;
+    size_t  min_size;
+    bool    context_takeover;
+};
+
+const DeflateOptions& deflate_options();
+
+// The permessage-deflate extension of WebSocket++, of which only the offer of
+// the client is changed: WebSocket++ always makes the same offer. The
+// DeflateExtension offers the extension only when it is enabled, with the
+// configured context takeover.
+template <typename config>
+class DeflateExtension : public websocketpp::extensions::permessage_deflate::enabled<config> {
+public:
+    DeflateExtension() {
+        if (!deflate_options().context_takeover) {
+            this->enable_client_no_context_takeover();
+        }
+    }
+
+    std::string generate_offer() const {
+        const DeflateOptions& options = deflate_options();
+        if (!options.enabled) {
+            return "";
+        }
+        if (!options.context_takeover) {
+            return "permessage-deflate; client_max_window_bits; "
+                   "client_no_context_takeover; server_no_context_takeover";
+        }
+        return "permessage-deflate; client_max_window_bits";
+    }
+};
+
+#endif // DEFLATE_EXTENSION_HPP
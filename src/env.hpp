@@ -0,0 +1,27 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef ENV_HPP
+#define ENV_HPP
+
+#include <cerrno>
+#include <cstdlib>
+
+namespace axini {
+    // The numeric value of the environment variable name, or default_value
+    // if it is not set or not a number. Flags are numbers as well: 0 is false.
+    inline long env_long(const char* name, long default_value) {
+        const char* value = std::getenv(name);
+        if (value == 0) {
+            return default_value;
+        }
+        char* end = 0;
+        errno = 0;
+        long number = std::strtol(value, &end, 10);
+        if (end == value || *end != '\0' || errno == ERANGE) {
+            return default_value;
+        }
+        return number;
+    }
+}
+
+#endif // ENV_HPP
@@ -5,22 +5,64 @@
 #include "handler.hpp"
 #include "adapter_core.hpp"
 
-Handler::Handler() {}
+Handler::Handler()
+    : adapter_core_ptr(0),
+      recorder_ptr(0),
+      announcement_version(1),
+      snapshot(std::make_shared<ConfigurationSnapshot>(Configuration())) {
+}
 Handler::~Handler() {}
 
+bool Handler::is_started() {
+    return false;
+}
+
+void Handler::pause_reading() {
+}
+
+void Handler::resume_reading() {
+}
+
+void Handler::dump_statistics() {
+}
+
 void Handler::send_ready_to_amp() {
     spdlog::info("Handler::send_ready_to_amp");
     adapter_core_ptr->send_ready();
 }
 
+void Handler::dispatch(std::function<void()> event) {
+    if (adapter_core_ptr != 0) {
+        adapter_core_ptr->dispatch(event);
+    } else {
+        event();
+    }
+}
+
 void Handler::register_adapter_core(AdapterCore* adapter_core_ptr) {
     this->adapter_core_ptr = adapter_core_ptr;
 }
 
-void Handler::set_configuration(Configuration configuration) {
-    this->configuration = configuration;
+// The Handler does not "own" the SessionRecorder.
+void Handler::register_recorder(SessionRecorder* recorder_ptr) {
+    this->recorder_ptr = recorder_ptr;
+}
+
+// The snapshot is built before it is published.
+void Handler::set_configuration(const Configuration& configuration) {
+    std::shared_ptr<const ConfigurationSnapshot> new_snapshot =
+        std::make_shared<ConfigurationSnapshot>(configuration);
+    std::atomic_store(&snapshot, new_snapshot);
+}
+
+std::shared_ptr<const ConfigurationSnapshot> Handler::get_snapshot() {
+    return std::atomic_load(&snapshot);
+}
+
+void Handler::invalidate_announcement() {
+    announcement_version++;
 }
 
-Configuration Handler::get_configuration() {
-    return configuration;
+unsigned long Handler::get_announcement_version() {
+    return announcement_version;
 }
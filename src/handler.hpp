@@ -3,10 +3,15 @@
 #ifndef HANDLER_HPP
 #define HANDLER_HPP
 
+#include <functional>
+#include <memory>
+
+#include "configuration_snapshot.hpp"
 #include "pa_protobuf.hpp"
 using namespace PluginAdapter::Api;
 
 class AdapterCore;
+class SessionRecorder;
 
 // The Handler is an abstract base class, which declares the functions
 // that the specific handler should implement. It communicates with the
@@ -15,27 +20,65 @@ class AdapterCore;
 class Handler {
 public:
     Handler();
-    ~Handler();
+    virtual ~Handler();
 
     virtual void start() = 0;
     virtual void stop() = 0;
     virtual void reset() = 0;
 
-    virtual std::string stimulate(Label stimulus) = 0;
+    // Whether the handler has a (possibly idle) connection with the SUT,
+    // which can be reused by calling reset() instead of start().
+    virtual bool is_started();
+
+    // Returns the physical label. The send_time is set to the (monotonic)
+    // time the stimulus was handed to the connection with the SUT, or to 0
+    // if it was not sent.
+    virtual std::string stimulate(const Label& stimulus, long& send_time) = 0;
+
+    // Backpressure: the AdapterCore pauses reading from the SUT while AMP
+    // does not keep up with the responses. By default, nothing is paused.
+    virtual void pause_reading();
+    virtual void resume_reading();
+
+    // Log the statistics of the connection with the SUT.
+    virtual void dump_statistics();
     void send_ready_to_amp();
 
+    // Events from the SUT must be dispatched to the AdapterCore, so that
+    // they are processed on the same thread as the events from AMP.
+    void dispatch(std::function<void()> event);
+
     void register_adapter_core(AdapterCore* adapter_core_ptr);
 
-    void set_configuration(Configuration configuration);
-    Configuration get_configuration();
+    // Record the messages to and from the SUT (see session_recorder.hpp).
+    void register_recorder(SessionRecorder* recorder_ptr);
+
+    // A new configuration replaces the ConfigurationSnapshot atomically; a
+    // snapshot itself is never modified. get_snapshot() loads the current
+    // snapshot atomically: hold on to the returned pointer while using
+    // references into the snapshot, as a next set_configuration() may
+    // release it.
+    void set_configuration(const Configuration& configuration);
+    std::shared_ptr<const ConfigurationSnapshot> get_snapshot();
     virtual Configuration default_configuration() = 0;
 
     // The labels supported by the plugin adapter.
     virtual std::vector<Label> get_supported_labels() = 0;
 
+    // The announcement to AMP is built from the supported labels and the
+    // default configuration, and is cached by the AdapterCore. A handler
+    // should call invalidate_announcement() when either of them changes.
+    void invalidate_announcement();
+    unsigned long get_announcement_version();
+
 protected:
-    AdapterCore*    adapter_core_ptr;
-    Configuration   configuration;
+    AdapterCore*      adapter_core_ptr;
+    SessionRecorder*  recorder_ptr;
+    unsigned long     announcement_version;
+
+private:
+    // Only accessed with std::atomic_load and std::atomic_store.
+    std::shared_ptr<const ConfigurationSnapshot>  snapshot;
 };
 
 #endif // HANDLER_HPP
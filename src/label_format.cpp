@@ -0,0 +1,171 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <cstring>
+#include <ctime>
+
+#include "label_format.hpp"
+
+static const char   TRUNCATED[] = "...";
+static const size_t NUMBER_SIZE = 64;
+
+// Appends to the buffer until the limit has been reached. Once truncated,
+// all further output is ignored, so a huge label is not traversed further.
+class LabelWriter {
+public:
+    LabelWriter(fmt::memory_buffer& buffer, size_t limit)
+        : buffer(buffer),
+          start(buffer.size()),
+          limit(limit),
+          truncated(false) {
+    }
+
+    bool is_truncated() {
+        return truncated;
+    }
+
+    void append(const char* begin, size_t length) {
+        if (truncated) {
+            return;
+        }
+        size_t room = limit - (buffer.size() - start);
+        if (length > room) {
+            buffer.append(begin, begin + room);
+            buffer.append(TRUNCATED, TRUNCATED + sizeof(TRUNCATED) - 1);
+            truncated = true;
+            return;
+        }
+        buffer.append(begin, begin + length);
+    }
+
+    void append(const std::string& s) {
+        append(s.data(), s.size());
+    }
+
+    void append(const char* s) {
+        append(s, std::strlen(s));
+    }
+
+    // Numbers are formatted on the stack first, to respect the limit.
+    template <typename... Args>
+    void append_formatted(const char* format, const Args&... args) {
+        char number[NUMBER_SIZE];
+        fmt::format_to_n_result<char*> result =
+            fmt::format_to_n(number, sizeof(number), format, args...);
+        append(number, result.out - number);
+    }
+
+    // A time which cannot be converted to a date is written as the raw
+    // number of seconds, e.g. "@18446744073709551615".
+    void append_time(unsigned long seconds, long nanoseconds) {
+        time_t time = seconds;
+        struct tm tm;
+        if (time < 0 || gmtime_r(&time, &tm) == 0) {
+            append_formatted("@{}", seconds);
+            return;
+        }
+        append_formatted("{:04}-{:02}-{:02}T{:02}:{:02}:{:02}",
+                         tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                         tm.tm_hour, tm.tm_min, tm.tm_sec);
+        if (nanoseconds >= 0) {
+            append_formatted(".{:09}", nanoseconds);
+        }
+        append("Z", 1);
+    }
+
+    void append_value(const Label_Parameter_Value& value);
+    void append_entries(const Label_Parameter_Value_Hash& hash, const char* separator);
+
+private:
+    fmt::memory_buffer&  buffer;
+    size_t               start;
+    size_t               limit;
+    bool                 truncated;
+};
+
+void LabelWriter::append_value(const Label_Parameter_Value& value) {
+    switch (value.type_case()) {
+    case Label_Parameter_Value::kString:
+        append(value.string());
+        break;
+    case Label_Parameter_Value::kInteger:
+        append_formatted("{}", value.integer());
+        break;
+    case Label_Parameter_Value::kDecimal:
+        append_formatted("{}", value.decimal());
+        break;
+    case Label_Parameter_Value::kBoolean:
+        append(value.boolean() ? "true" : "false");
+        break;
+    case Label_Parameter_Value::kDate:
+        append_time(value.date(), -1);
+        break;
+    case Label_Parameter_Value::kTime:
+        append_time(value.time() / 1000000000UL, value.time() % 1000000000UL);
+        break;
+    case Label_Parameter_Value::kArray:
+        append("[", 1);
+        for (int i = 0; i < value.array().values_size() && !truncated; i++) {
+            if (i > 0) {
+                append(", ", 2);
+            }
+            append_value(value.array().values(i));
+        }
+        append("]", 1);
+        break;
+    case Label_Parameter_Value::kStruct:
+        append_entries(value.struct_(), ": ");
+        break;
+    case Label_Parameter_Value::kHashValue:
+        append_entries(value.hash_value(), " => ");
+        break;
+    default:
+        append("nil", 3);
+        break;
+    }
+}
+
+void LabelWriter::append_entries(const Label_Parameter_Value_Hash& hash, const char* separator) {
+    append("{", 1);
+    for (int i = 0; i < hash.entries_size() && !truncated; i++) {
+        if (i > 0) {
+            append(", ", 2);
+        }
+        append_value(hash.entries(i).key());
+        append(separator);
+        append_value(hash.entries(i).value());
+    }
+    append("}", 1);
+}
+
+void axini::format_to(fmt::memory_buffer& buffer, const Label& label, size_t limit) {
+    LabelWriter writer(buffer, limit);
+    writer.append(label.type() == Label::STIMULUS ? "?[" : "![", 2);
+    writer.append(label.channel());
+    writer.append("]", 1);
+    writer.append(label.label());
+
+    for (int i = 0; i < label.parameters_size() && !writer.is_truncated(); i++) {
+        const Label_Parameter& parameter = label.parameters(i);
+        writer.append(i == 0 ? " (" : ", ", 2);
+        writer.append(parameter.name());
+        writer.append(": ", 2);
+        writer.append_value(parameter.value());
+    }
+    if (label.parameters_size() > 0) {
+        writer.append(")", 1);
+    }
+}
+
+void axini::format_to(fmt::memory_buffer& buffer, const Label_Parameter& parameter,
+                      size_t limit) {
+    LabelWriter writer(buffer, limit);
+    writer.append(parameter.name());
+    writer.append(": ", 2);
+    writer.append_value(parameter.value());
+}
+
+void axini::format_to(fmt::memory_buffer& buffer, const Label_Parameter_Value& value,
+                      size_t limit) {
+    LabelWriter writer(buffer, limit);
+    writer.append_value(value);
+}
@@ -0,0 +1,37 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef LABEL_FORMAT_HPP
+#define LABEL_FORMAT_HPP
+
+#include <cstddef>
+
+#include "spdlog/fmt/fmt.h"
+
+#include "pa_protobuf.hpp"
+using namespace PluginAdapter::Api;
+
+// Formatting of Labels and parameter values into a caller-supplied buffer.
+// The buffer can be reused for many labels: apart from growing the buffer,
+// formatting does not allocate. All parameter value types are supported,
+// also nested arrays, structs and hashes:
+//
+//     ?[door]lock (passcode: 1234, codes: [1, 2], owner: {name: Jan})
+//
+// Dates are written as 2023-03-01T12:00:00Z, times as
+// 2023-03-01T12:00:00.123456789Z, a value without type as nil.
+//
+// The output of a single call is capped at limit characters; a truncated
+// label ends with "...". This keeps huge payloads out of the log.
+
+namespace axini {
+    const size_t LABEL_FORMAT_LIMIT = 4096;
+
+    void format_to(fmt::memory_buffer& buffer, const Label& label,
+                   size_t limit = LABEL_FORMAT_LIMIT);
+    void format_to(fmt::memory_buffer& buffer, const Label_Parameter& parameter,
+                   size_t limit = LABEL_FORMAT_LIMIT);
+    void format_to(fmt::memory_buffer& buffer, const Label_Parameter_Value& value,
+                   size_t limit = LABEL_FORMAT_LIMIT);
+}
+
+#endif // LABEL_FORMAT_HPP
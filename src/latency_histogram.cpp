@@ -0,0 +1,163 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "latency_histogram.hpp"
+#include "clock.hpp"
+
+// ----- LatencyHistogram
+
+LatencyHistogram::LatencyHistogram()
+    : total_count(0),
+      max_value(0) {
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        counts[i] = 0;
+    }
+}
+
+void LatencyHistogram::record(long nanoseconds) {
+    uint64_t value = (nanoseconds > 0) ? nanoseconds : 0;
+    counts[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+    total_count.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = max_value.load(std::memory_order_relaxed);
+    while (value > max &&
+           !max_value.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::get_count() const {
+    return total_count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::get_max() const {
+    return max_value.load(std::memory_order_relaxed);
+}
+
+// The returned value is the highest value of the bucket in which the
+// percentile falls, with 0 < percentile <= 100.
+uint64_t LatencyHistogram::get_percentile(double percentile) const {
+    uint64_t count = get_count();
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (percentile / 100.0 * count + 0.5);
+    rank = std::max<uint64_t>(1, std::min(rank, count));
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(bucket_upper_value(i), get_max());
+        }
+    }
+    return get_max();
+}
+
+// Values below 2 * SUB_BUCKET_COUNT have their own bucket. Larger values
+// share a bucket with the values that have the same SUB_BUCKET_BITS + 1
+// most significant bits.
+size_t LatencyHistogram::bucket_index(uint64_t value) {
+    if (value < 2 * SUB_BUCKET_COUNT) {
+        return value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= MAX_VALUE_BITS) {
+        return BUCKET_COUNT - 1;
+    }
+    int shift = msb - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKET_COUNT + ((value >> shift) - SUB_BUCKET_COUNT);
+}
+
+uint64_t LatencyHistogram::bucket_upper_value(size_t index) {
+    if (index < 2 * SUB_BUCKET_COUNT) {
+        return index;
+    }
+
+    int shift = index / SUB_BUCKET_COUNT - 1;
+    uint64_t sub_bucket = index % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+// ----- LatencyRecorder
+
+static const char* LEG_NAMES[LATENCY_LEG_COUNT] = {
+    "amp-receive->parse",
+    "parse->sut-send",
+    "sut-receive->amp-send",
+    "stimulus-ack",
+    "configuration->ready",
+    "reset->performed",
+    "parse->paced"
+};
+
+LatencyRecorder::LatencyRecorder() {
+}
+
+// The LatencyRecorder "owns" the histograms of the labels.
+LatencyRecorder::~LatencyRecorder() {
+    for (std::pair<const std::string, LabelLatencies*>& entry : labels) {
+        delete entry.second;
+    }
+}
+
+void LatencyRecorder::add_label(const std::string& label_name) {
+    if (labels.find(label_name) == labels.end()) {
+        labels[label_name] = new LabelLatencies();
+    }
+}
+
+void LatencyRecorder::record(const std::string& label_name, LatencyLeg leg,
+                             long nanoseconds) {
+    std::unordered_map<std::string, LabelLatencies*>::iterator it = labels.find(label_name);
+    LabelLatencies* latencies_ptr = (it != labels.end()) ? it->second : &other;
+    latencies_ptr->legs[leg].record(nanoseconds);
+}
+
+const LatencyHistogram& LatencyRecorder::get_histogram(const std::string& label_name,
+                                                       LatencyLeg leg) {
+    std::unordered_map<std::string, LabelLatencies*>::iterator it = labels.find(label_name);
+    LabelLatencies* latencies_ptr = (it != labels.end()) ? it->second : &other;
+    return latencies_ptr->legs[leg];
+}
+
+void LatencyRecorder::dump(const std::string& title) {
+    std::vector<std::string> names;
+    for (std::pair<const std::string, LabelLatencies*>& entry : labels) {
+        names.push_back(entry.first);
+    }
+    std::sort(names.begin(), names.end());
+    names.push_back("(other)");
+
+    spdlog::info("Latencies of " + title + " in microseconds:");
+    for (const std::string& name : names) {
+        LabelLatencies* latencies_ptr = (name == "(other)") ? &other : labels[name];
+        for (int leg = 0; leg < LATENCY_LEG_COUNT; leg++) {
+            const LatencyHistogram& histogram = latencies_ptr->legs[leg];
+            if (histogram.get_count() == 0) {
+                continue;
+            }
+
+            char line[256];
+            snprintf(line, sizeof(line),
+                "  %-20s %-22s n=%-8llu p50=%-10.1f p90=%-10.1f p99=%-10.1f p99.9=%-10.1f max=%.1f",
+                name.c_str(), LEG_NAMES[leg],
+                (unsigned long long) histogram.get_count(),
+                histogram.get_percentile(50.0) / 1000.0,
+                histogram.get_percentile(90.0) / 1000.0,
+                histogram.get_percentile(99.0) / 1000.0,
+                histogram.get_percentile(99.9) / 1000.0,
+                histogram.get_max() / 1000.0);
+            spdlog::info(line);
+        }
+    }
+}
+
+long LatencyRecorder::now() {
+    return axini::monotonic_now();
+}
@@ -0,0 +1,85 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// A LatencyHistogram counts latencies in nanoseconds in HDR-style buckets:
+// every power of two is divided in 32 linear sub-buckets, which gives a
+// precision of about 3% over the whole range (up to ~18 minutes). Recording
+// a value is lock-free and can be done concurrently from several threads.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(long nanoseconds);
+
+    uint64_t get_count() const;
+    uint64_t get_max() const;
+    uint64_t get_percentile(double percentile) const;
+
+private:
+    static const int      SUB_BUCKET_BITS  = 5;
+    static const uint64_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static const int      MAX_VALUE_BITS   = 40;
+    static const size_t   BUCKET_COUNT     =
+        (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    static size_t   bucket_index(uint64_t value);
+    static uint64_t bucket_upper_value(size_t index);
+
+private:
+    std::atomic<uint64_t>  counts[BUCKET_COUNT];
+    std::atomic<uint64_t>  total_count;
+    std::atomic<uint64_t>  max_value;
+};
+
+// The legs of the message path of which the latencies are recorded.
+enum LatencyLeg {
+    BROKER_RECEIVE_TO_PARSE,        // stimulus received from AMP until parsed
+    PARSE_TO_SUT_SEND,              // stimulus parsed until sent to the SUT
+    SUT_RECEIVE_TO_BROKER_SEND,     // response received from SUT until sent to AMP
+    STIMULUS_ACKNOWLEDGEMENT,       // stimulus received from AMP until acknowledged
+    CONFIGURATION_TO_READY,         // configuration received from AMP until Ready sent
+    RESET_ROUND_TRIP,               // reset sent to the SUT until RESET_PERFORMED received
+    PACING_QUEUE_DELAY,             // stimulus parsed until released by the StimulusPacer
+    LATENCY_LEG_COUNT
+};
+
+// The latencies of the session, rather than of a label, are recorded under
+// this name, e.g. CONFIGURATION_TO_READY and RESET_ROUND_TRIP.
+const std::string SESSION_LATENCIES = "(session)";
+
+// The LatencyRecorder keeps a LatencyHistogram per label name and per leg.
+// The label names must be added before recording starts; latencies of labels
+// that have not been added are recorded under "(other)".
+class LatencyRecorder {
+public:
+    LatencyRecorder();
+    ~LatencyRecorder();
+
+    void add_label(const std::string& label_name);
+    void record(const std::string& label_name, LatencyLeg leg, long nanoseconds);
+    const LatencyHistogram& get_histogram(const std::string& label_name, LatencyLeg leg);
+
+    // Log the percentiles of all non-empty histograms.
+    void dump(const std::string& title);
+
+    // Monotonic time in nanoseconds, to compute latencies with
+    // (see axini::monotonic_now).
+    static long now();
+
+private:
+    struct LabelLatencies {
+        LatencyHistogram legs[LATENCY_LEG_COUNT];
+    };
+
+    std::unordered_map<std::string, LabelLatencies*>  labels;
+    LabelLatencies                                    other;
+};
+
+#endif // LATENCY_HISTOGRAM_HPP
@@ -0,0 +1,71 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef LIFETIME_GUARD_HPP
+#define LIFETIME_GUARD_HPP
+
+#include <memory>
+#include <mutex>
+#include <utility>
+
+// A LifetimeGuard protects an object against the callbacks which it hands to
+// an io_service it does not own: a posted function or the handler of an
+// expired timer may still be run after the object has been deleted.
+//
+// Such callbacks are wrapped by the guard. A wrapped callback only calls the
+// original callback while the guard is valid. invalidate(), called by the
+// destructor of the object, waits for a wrapped callback which is running on
+// another thread, and turns all later calls into no-ops. The lock is
+// recursive: a wrapped callback may delete the object itself.
+class LifetimeGuard {
+private:
+    struct State {
+        std::recursive_mutex  mutex;
+        bool                  valid;
+    };
+
+public:
+    template<typename Callback>
+    class Guarded {
+    public:
+        Guarded(const std::shared_ptr<State>& state_ptr, Callback callback)
+            : state_ptr(state_ptr), callback(callback) {}
+
+        // The state is kept alive by a copy: the call may destroy this
+        // wrapper, e.g. by deleting the owner of a WebSocket++ handler.
+        template<typename... Args>
+        void operator()(Args&&... args) const {
+            std::shared_ptr<State> state = state_ptr;
+            std::lock_guard<std::recursive_mutex> lock(state->mutex);
+            if (state->valid) {
+                callback(std::forward<Args>(args)...);
+            }
+        }
+
+    private:
+        std::shared_ptr<State>  state_ptr;
+        Callback                callback;
+    };
+
+    LifetimeGuard() : state_ptr(std::make_shared<State>()) {
+        state_ptr->valid = true;
+    }
+
+    ~LifetimeGuard() {
+        invalidate();
+    }
+
+    template<typename Callback>
+    Guarded<Callback> wrap(Callback callback) {
+        return Guarded<Callback>(state_ptr, callback);
+    }
+
+    void invalidate() {
+        std::lock_guard<std::recursive_mutex> lock(state_ptr->mutex);
+        state_ptr->valid = false;
+    }
+
+private:
+    std::shared_ptr<State> state_ptr;
+};
+
+#endif // LIFETIME_GUARD_HPP
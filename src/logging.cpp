@@ -0,0 +1,51 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <atomic>
+
+#include "spdlog/async.h"
+#include "spdlog/cfg/env.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+
+#include "logging.hpp"
+#include "env.hpp"
+
+static std::atomic<unsigned> log_sample_rate(1);
+static std::atomic<unsigned long> log_sample_counter(0);
+static thread_local bool log_hot_path = true;
+
+void axini::init_logging(bool async, size_t queue_size, unsigned sample_rate) {
+    set_log_sample_rate(sample_rate);
+    if (!async) {
+        return;
+    }
+
+    // The logger has no name, so that the output looks like the synchronous
+    // default logger's output.
+    spdlog::init_thread_pool(queue_size, 1);
+    spdlog::sink_ptr sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+    std::shared_ptr<spdlog::logger> logger = std::make_shared<spdlog::async_logger>(
+        "", sink, spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest);
+    spdlog::set_default_logger(logger);
+}
+
+void axini::init_logging_from_env() {
+    bool async         = axini::env_long("ADAPTER_LOG_ASYNC", 1) != 0;
+    long queue_size    = axini::env_long("ADAPTER_LOG_QUEUE", 8192);
+    long sample_rate   = axini::env_long("ADAPTER_LOG_SAMPLE", 1);
+
+    init_logging(async, queue_size > 0 ? queue_size : 8192, sample_rate > 0 ? sample_rate : 1);
+    spdlog::cfg::load_env_levels();
+}
+
+void axini::set_log_sample_rate(unsigned sample_rate) {
+    log_sample_rate = (sample_rate > 0) ? sample_rate : 1;
+}
+
+void axini::sample_hot_path() {
+    unsigned rate = log_sample_rate;
+    log_hot_path = (rate == 1) || (log_sample_counter++ % rate == 0);
+}
+
+bool axini::hot_path_sampled() {
+    return log_hot_path;
+}
@@ -0,0 +1,72 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef LOGGING_HPP
+#define LOGGING_HPP
+
+#include <string>
+
+#include "spdlog/spdlog.h"
+#include "spdlog/fmt/fmt.h"
+
+#include "axini_protobuf.hpp"
+#include "label_format.hpp"
+
+// Logging of the message path ("hot path").
+//
+// * The minimum level is fixed at compile time with SPDLOG_ACTIVE_LEVEL
+//   (see the makefile): hot path log statements below that level are removed.
+// * Hot path log statements are sampled: only 1 in N incoming messages
+//   (stimuli from AMP, responses from the SUT) is logged. The sample rate can
+//   be set at runtime.
+// * Arguments are formatted by spdlog, and only when the statement is logged.
+//   Labels can be passed as arguments directly, e.g.
+//       LOG_HOT_INFO("label received: {}", label);
+
+namespace axini {
+    // Set up the default logger. If async is true, log messages are written by
+    // a background thread from a bounded ring buffer of queue_size messages;
+    // when the buffer is full the oldest messages are dropped.
+    void init_logging(bool async, size_t queue_size, unsigned sample_rate);
+
+    // Initialize the logging from the environment variables ADAPTER_LOG_ASYNC,
+    // ADAPTER_LOG_QUEUE, ADAPTER_LOG_SAMPLE and SPDLOG_LEVEL.
+    void init_logging_from_env();
+
+    void set_log_sample_rate(unsigned sample_rate);
+
+    // Decide whether the hot path log statements for the incoming message that
+    // is about to be processed by the current thread should be logged.
+    void sample_hot_path();
+    bool hot_path_sampled();
+}
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define LOG_HOT_DEBUG(...) \
+    do { if (axini::hot_path_sampled()) spdlog::debug(__VA_ARGS__); } while (0)
+#else
+#define LOG_HOT_DEBUG(...) (void) 0
+#endif
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_INFO
+#define LOG_HOT_INFO(...) \
+    do { if (axini::hot_path_sampled()) spdlog::info(__VA_ARGS__); } while (0)
+#else
+#define LOG_HOT_INFO(...) (void) 0
+#endif
+
+// Format Labels only when they are actually logged. The label is formatted
+// into a buffer on the stack, and capped at axini::LABEL_FORMAT_LIMIT.
+namespace fmt {
+    template <>
+    struct formatter<PluginAdapter::Api::Label> : formatter<string_view> {
+        template <typename FormatContext>
+        auto format(const PluginAdapter::Api::Label& label, FormatContext& ctx) const
+                -> decltype(ctx.out()) {
+            memory_buffer buffer;
+            axini::format_to(buffer, label);
+            return formatter<string_view>::format(string_view(buffer.data(), buffer.size()), ctx);
+        }
+    };
+}
+
+#endif // LOGGING_HPP
@@ -0,0 +1,28 @@
+# The text protocol of the standalone SmartDoor SUT, for the
+# TextProtocolHandler (see text_protocol.hpp).
+#
+# <kind> <label> <pattern>, where a pattern consists of literal text and
+# parameters {name:type} with type int, decimal, bool or string.
+
+channel door
+
+stimulus open                OPEN
+stimulus close               CLOSE
+stimulus lock                LOCK:{passcode:int}
+stimulus unlock              UNLOCK:{passcode:int}
+
+response opened              OPENED
+response closed              CLOSED
+response locked              LOCKED
+response unlocked            UNLOCKED
+response invalid_command     INVALID_COMMAND
+response invalid_passcode    INVALID_PASSCODE
+response incorrect_passcode  INCORRECT_PASSCODE
+response shut_off            SHUT_OFF
+
+# Extra stimulus to reset the SUT.
+stimulus reset               RESET:{manufacturer:string}
+
+# The reset sent by the adapter; the manufacturer is taken from the configuration.
+reset                        RESET:{manufacturer:string}
+reset_performed              RESET_PERFORMED
@@ -0,0 +1,31 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <algorithm>
+
+#include "reconnect_scheduler.hpp"
+
+ReconnectScheduler::ReconnectScheduler(long initial_delay, long max_delay)
+    : initial_delay(std::max(1L, initial_delay)),
+      max_delay(std::max(this->initial_delay, max_delay)),
+      backoff(this->initial_delay),
+      attempts(0),
+      random(std::random_device()()) {
+}
+
+long ReconnectScheduler::next_delay() {
+    std::uniform_int_distribution<long> jitter(backoff / 2, backoff);
+    long delay = jitter(random);
+
+    attempts++;
+    backoff = std::min(backoff * 2, max_delay);
+    return delay;
+}
+
+void ReconnectScheduler::reset() {
+    backoff = initial_delay;
+    attempts = 0;
+}
+
+unsigned ReconnectScheduler::get_attempts() {
+    return attempts;
+}
@@ -0,0 +1,33 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef RECONNECT_SCHEDULER_HPP
+#define RECONNECT_SCHEDULER_HPP
+
+#include <random>
+
+// The ReconnectScheduler computes the delays between the attempts to
+// (re)connect to AMP: exponential backoff, capped at a maximum delay, with
+// jitter so that many adapters do not reconnect in lockstep when AMP restarts.
+// All delays are in milliseconds.
+class ReconnectScheduler {
+public:
+    ReconnectScheduler(long initial_delay, long max_delay);
+
+    // The delay before the next attempt: a random value between half of and
+    // the full backoff. The backoff doubles with every attempt.
+    long next_delay();
+
+    // The connection has been established: start again with the initial delay.
+    void reset();
+
+    unsigned get_attempts();
+
+private:
+    long          initial_delay;
+    long          max_delay;
+    long          backoff;
+    unsigned      attempts;
+    std::mt19937  random;
+};
+
+#endif // RECONNECT_SCHEDULER_HPP
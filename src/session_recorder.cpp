@@ -0,0 +1,207 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "spdlog/spdlog.h"
+#include "session_recorder.hpp"
+
+static const char   MAGIC[8]          = { 'A', 'X', 'S', 'E', 'S', 'S', '0', '1' };
+static const size_t RECORD_HEADER_SIZE = 16;
+
+static size_t padded_size(size_t length) {
+    return (RECORD_HEADER_SIZE + length + 7) & ~((size_t) 7);
+}
+
+// ----- SessionRecorder
+
+SessionRecorder::SessionRecorder(const std::string& filename, size_t capacity)
+    : filename(filename),
+      fd(-1),
+      data(0),
+      capacity(capacity > HEADER_SIZE ? capacity : HEADER_SIZE),
+      size(HEADER_SIZE),
+      dropped(0) {
+    for (int i = 0; i < RECORD_DIRECTION_COUNT; i++) {
+        counts[i] = 0;
+    }
+
+    void* mapping;
+    if (filename.empty()) {
+        mapping = mmap(0, this->capacity, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, this->capacity) != 0) {
+            spdlog::error("SessionRecorder: cannot create " + filename + ": " +
+                          std::strerror(errno));
+            return;
+        }
+        mapping = mmap(0, this->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if (mapping == MAP_FAILED) {
+        spdlog::error("SessionRecorder: cannot map recording: " + std::string(std::strerror(errno)));
+        return;
+    }
+    data = (char*) mapping;
+    std::memcpy(data, MAGIC, sizeof(MAGIC));
+}
+
+// The file is truncated to the part that has actually been recorded.
+SessionRecorder::~SessionRecorder() {
+    if (data != 0) {
+        munmap(data, capacity);
+    }
+    if (fd >= 0) {
+        if (ftruncate(fd, size) != 0) {
+            spdlog::error("SessionRecorder: cannot truncate " + filename);
+        }
+        close(fd);
+    }
+    if (dropped > 0) {
+        spdlog::warn("SessionRecorder: " + std::to_string(dropped) +
+                     " messages dropped, the recording is full");
+    }
+}
+
+bool SessionRecorder::is_open() {
+    return data != 0;
+}
+
+// The space for the record is reserved with a compare-and-swap, so several
+// threads can record at the same time. The direction is stored last.
+void SessionRecorder::record(RecordDirection direction, const void* payload, size_t length,
+                             long time) {
+    if (data == 0) {
+        return;
+    }
+
+    size_t record_size = padded_size(length);
+    size_t offset = size.load(std::memory_order_relaxed);
+    do {
+        if (offset + record_size > capacity) {
+            dropped++;
+            return;
+        }
+    } while (!size.compare_exchange_weak(offset, offset + record_size,
+                                         std::memory_order_relaxed));
+
+    char* record_ptr = data + offset;
+    int64_t record_time = time;
+    uint32_t record_length = length;
+    std::memcpy(record_ptr, &record_time, sizeof(record_time));
+    std::memcpy(record_ptr + 8, &record_length, sizeof(record_length));
+    std::memcpy(record_ptr + RECORD_HEADER_SIZE, payload, length);
+    __atomic_store_n((uint32_t*) (record_ptr + 12), (uint32_t) direction, __ATOMIC_RELEASE);
+
+    counts[direction].fetch_add(1, std::memory_order_relaxed);
+}
+
+void SessionRecorder::record(RecordDirection direction, const std::string& payload, long time) {
+    record(direction, payload.data(), payload.size(), time);
+}
+
+uint64_t SessionRecorder::get_count(RecordDirection direction) {
+    return counts[direction].load(std::memory_order_relaxed);
+}
+
+uint64_t SessionRecorder::get_dropped() {
+    return dropped;
+}
+
+const char* SessionRecorder::get_data() {
+    return data;
+}
+
+size_t SessionRecorder::get_size() {
+    return size;
+}
+
+// ----- SessionReader
+
+SessionReader::SessionReader(const std::string& filename)
+    : fd(-1),
+      data(0),
+      size(0),
+      offset(SessionRecorder::HEADER_SIZE),
+      mapped(false) {
+    fd = open(filename.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0) {
+        spdlog::error("SessionReader: cannot open " + filename + ": " + std::strerror(errno));
+        return;
+    }
+    if (file_stat.st_size < (off_t) SessionRecorder::HEADER_SIZE) {
+        spdlog::error("SessionReader: " + filename + " is not a recording");
+        return;
+    }
+
+    void* mapping = mmap(0, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        spdlog::error("SessionReader: cannot map " + filename + ": " + std::strerror(errno));
+        return;
+    }
+    if (std::memcmp(mapping, MAGIC, sizeof(MAGIC)) != 0) {
+        spdlog::error("SessionReader: " + filename + " is not a recording");
+        munmap(mapping, file_stat.st_size);
+        return;
+    }
+    data = (const char*) mapping;
+    size = file_stat.st_size;
+    mapped = true;
+}
+
+SessionReader::SessionReader(const char* data, size_t size)
+    : fd(-1),
+      data(data),
+      size(size),
+      offset(SessionRecorder::HEADER_SIZE),
+      mapped(false) {
+}
+
+SessionReader::~SessionReader() {
+    if (mapped) {
+        munmap((void*) data, size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool SessionReader::is_open() {
+    return data != 0 && size >= SessionRecorder::HEADER_SIZE;
+}
+
+// Returns false at the end of the recording, or at the first incomplete record.
+bool SessionReader::next(SessionRecord* record_ptr) {
+    if (!is_open() || offset + RECORD_HEADER_SIZE > size) {
+        return false;
+    }
+
+    const char* header_ptr = data + offset;
+    uint32_t direction = __atomic_load_n((const uint32_t*) (header_ptr + 12), __ATOMIC_ACQUIRE);
+    if (direction == 0 || direction >= RECORD_DIRECTION_COUNT) {
+        return false;
+    }
+
+    int64_t time;
+    uint32_t length;
+    std::memcpy(&time, header_ptr, sizeof(time));
+    std::memcpy(&length, header_ptr + 8, sizeof(length));
+    if (offset + RECORD_HEADER_SIZE + length > size) {
+        return false;
+    }
+
+    record_ptr->time = time;
+    record_ptr->direction = (RecordDirection) direction;
+    record_ptr->payload = header_ptr + RECORD_HEADER_SIZE;
+    record_ptr->length = length;
+
+    offset += padded_size(length);
+    return true;
+}
@@ -0,0 +1,91 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef SESSION_RECORDER_HPP
+#define SESSION_RECORDER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// The direction of a recorded message, as seen from the adapter.
+enum RecordDirection {
+    FROM_AMP = 1,
+    TO_AMP   = 2,
+    FROM_SUT = 3,
+    TO_SUT   = 4,
+    RECORD_DIRECTION_COUNT
+};
+
+// The SessionRecorder records all messages of a session in a binary,
+// append-only file, which is preallocated and mapped into memory. Recording
+// a message is a copy into the mapping: no system calls, no locks.
+//
+// The file starts with a header of HEADER_SIZE bytes, followed by records:
+//     int64  time        monotonic time in nanoseconds (see clock.hpp)
+//     uint32 length      length of the payload
+//     uint32 direction   RecordDirection, written last
+//     char   payload[length], padded to a multiple of 8 bytes
+// A record is complete when its direction is set, so a file of a crashed
+// adapter can still be read up to the last complete record.
+//
+// If the file is full, further messages are dropped (and counted). When the
+// recorder is destroyed, the file is truncated to the recorded size.
+// Without a filename, the recording is kept in (anonymous) memory only.
+class SessionRecorder {
+public:
+    SessionRecorder(const std::string& filename, size_t capacity);
+    ~SessionRecorder();
+
+    bool is_open();
+
+    void record(RecordDirection direction, const void* payload, size_t length, long time);
+    void record(RecordDirection direction, const std::string& payload, long time);
+
+    uint64_t get_count(RecordDirection direction);
+    uint64_t get_dropped();
+
+    // The recorded bytes, including the header, e.g. to read them back with
+    // a SessionReader.
+    const char* get_data();
+    size_t get_size();
+
+    static const size_t HEADER_SIZE = 64;
+
+private:
+    std::string            filename;
+    int                    fd;
+    char*                  data;
+    size_t                 capacity;
+    std::atomic<size_t>    size;
+    std::atomic<uint64_t>  counts[RECORD_DIRECTION_COUNT];
+    std::atomic<uint64_t>  dropped;
+};
+
+struct SessionRecord {
+    long             time;
+    RecordDirection  direction;
+    const char*      payload;
+    size_t           length;
+};
+
+// The SessionReader reads the records of a recording, either from a file
+// (which is mapped into memory) or from the memory of a SessionRecorder.
+// The payloads point into the mapping and are valid as long as the reader.
+class SessionReader {
+public:
+    SessionReader(const std::string& filename);
+    SessionReader(const char* data, size_t size);
+    ~SessionReader();
+
+    bool is_open();
+    bool next(SessionRecord* record_ptr);
+
+private:
+    int          fd;
+    const char*  data;
+    size_t       size;
+    size_t       offset;
+    bool         mapped;
+};
+
+#endif // SESSION_RECORDER_HPP
@@ -1,14 +1,23 @@
 // Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
 
 #include "spdlog/spdlog.h"
+#include "logging.hpp"
+#include "latency_histogram.hpp"
 #include "smartdoor_connection.hpp"
 
 using websocketpp::lib::bind;
 using websocketpp::lib::placeholders::_1;
 using websocketpp::lib::placeholders::_2;
 
-SmartDoorConnection::SmartDoorConnection(std::string uri)
-    : handler_ptr(0),
+// While the buffered amount is above the high water mark, it is polled with
+// this interval (see broker_connection.cpp).
+static const long DRAIN_POLL_INTERVAL = 1; // milliseconds
+
+SmartDoorConnection::SmartDoorConnection(std::string uri,
+                                         websocketpp::lib::asio::io_service* io_service_ptr)
+    : reading_paused(false),
+      handler_ptr(0),
+      connection_id(0),
       server_uri(uri) {
 
     // WebSocket++ logging: pretty verbose (everything except message payloads).
@@ -21,19 +30,31 @@ SmartDoorConnection::SmartDoorConnection(std::string uri)
     m_endpoint.clear_access_channels(websocketpp::log::alevel::none);
     m_endpoint.set_error_channels(websocketpp::log::elevel::none);
 
+    // Register the callback handlers. They are guarded: on an external
+    // io_service, they may be called after this object has been deleted.
+    m_endpoint.set_socket_init_handler(lifetime_guard.wrap(
+        bind(&SmartDoorConnection::on_socket_init,this,::_1)));
+    m_endpoint.set_open_handler(lifetime_guard.wrap(
+        bind(&SmartDoorConnection::on_open,this,::_1)));
+    m_endpoint.set_close_handler(lifetime_guard.wrap(
+        bind(&SmartDoorConnection::on_close,this,::_1)));
+    m_endpoint.set_fail_handler(lifetime_guard.wrap(
+        bind(&SmartDoorConnection::on_fail,this,::_1)));
+    m_endpoint.set_message_handler(lifetime_guard.wrap(
+        bind(&SmartDoorConnection::on_message,this,::_1,::_2)));
+
+    if (io_service_ptr != 0) {
+        // Attach to the external io_service; its owner runs the event loop.
+        m_endpoint.init_asio(io_service_ptr);
+        return;
+    }
+
     // Initialize ASIO.
     m_endpoint.init_asio();
 
     // Marks the endpoint as perpetual, stopping it from exiting when empty.
     m_endpoint.start_perpetual();
 
-    // Register the callback handlers.
-    m_endpoint.set_socket_init_handler(bind(&SmartDoorConnection::on_socket_init,this,::_1));
-    m_endpoint.set_open_handler(bind(&SmartDoorConnection::on_open,this,::_1));
-    m_endpoint.set_close_handler(bind(&SmartDoorConnection::on_close,this,::_1));
-    m_endpoint.set_fail_handler(bind(&SmartDoorConnection::on_fail,this,::_1));
-    m_endpoint.set_message_handler(bind(&SmartDoorConnection::on_message,this,::_1,::_2));
-
     // Start a thread in the background which calls run.
     // This will start the ASIO io_service run loop. This will cause a single connection
     // to be made to the server. c.run() will exit when the connection is closed.
@@ -42,7 +63,23 @@ SmartDoorConnection::SmartDoorConnection(std::string uri)
 }
 
 SmartDoorConnection::~SmartDoorConnection() {
-    m_endpoint.stop_perpetual();
+    if (!m_thread) {
+        // The event loop outlives this object: wait for a callback which is
+        // running on another thread, and drop the ones which are still to
+        // come. The connection may thus be deleted from any thread.
+        lifetime_guard.invalidate();
+    }
+    cancel_timer();
+    {
+        std::lock_guard<std::mutex> lock(mark_mutex);
+        if (drain_timer) {
+            drain_timer->cancel();
+        }
+    }
+
+    if (m_thread) {
+        m_endpoint.stop_perpetual();
+    }
 
     websocketpp::lib::error_code ec;
     m_endpoint.close(m_hdl, websocketpp::close::status::going_away, "", ec);
@@ -50,7 +87,9 @@ SmartDoorConnection::~SmartDoorConnection() {
         spdlog::info("SmartDoorConnection: error closing connection: "  + ec.message());
     }
 
-    m_thread->join();
+    if (m_thread) {
+        m_thread->join();
+    }
 }
 
 void SmartDoorConnection::connect() {
@@ -78,14 +117,111 @@ void SmartDoorConnection::close(int code, std::string message) {
     }
 }
 
-void SmartDoorConnection::send(std::string message) {
-    spdlog::info("SmartDoorConnection::send: " + message);
+// The send time is taken right after the message has been handed to
+// WebSocket++, which starts the write at once if no write is in progress and
+// send is called on the event loop; otherwise the message is queued.
+long SmartDoorConnection::send(const std::string& message) {
+    LOG_HOT_INFO("SmartDoorConnection::send: {}", message);
     websocketpp::lib::error_code ec;
     m_endpoint.send(m_hdl, message, websocketpp::frame::opcode::text, ec);
+    long send_time = LatencyRecorder::now();
     if (ec) {
         spdlog::error("SmartDoorConnection: error sending message: " + ec.message());
+        return 0;
+    }
+    check_water_marks(false);
+    return send_time;
+}
+
+// Called after a send (on the AdapterCore's thread) and while draining (on the
+// event loop of the connection). The buffered amount is polled from the high
+// crossing until the low crossing; a crossing is reported to the handler.
+void SmartDoorConnection::check_water_marks(bool draining) {
+    WaterMarks::Crossing crossing;
+    {
+        std::lock_guard<std::mutex> lock(mark_mutex);
+        crossing = water_marks.update(get_buffered_amount(), LatencyRecorder::now());
+        if (water_marks.is_high() && (draining || crossing == WaterMarks::HIGH_CROSSING)) {
+            if (drain_timer) {
+                drain_timer->cancel();
+            }
+            drain_timer = m_endpoint.set_timer(DRAIN_POLL_INTERVAL, lifetime_guard.wrap(
+                [this](const websocketpp::lib::error_code& ec) {
+                    if (!ec) {
+                        check_water_marks(true);
+                    }
+                }));
+        }
+    }
+
+    if (crossing == WaterMarks::HIGH_CROSSING) {
+        spdlog::warn("SmartDoorConnection: above the high water mark, the SUT does not keep up");
+    }
+    if (crossing != WaterMarks::NO_CROSSING && handler_ptr != 0) {
+        handler_ptr->dispatch(std::bind(&SmartDoorHandler::on_sut_backpressure,
+            handler_ptr, connection_id, crossing == WaterMarks::HIGH_CROSSING));
+    }
+}
+
+// WebSocket++'s count of the bytes in the send queue of the connection.
+size_t SmartDoorConnection::get_buffered_amount() {
+    websocketpp::lib::error_code ec;
+    connection_ptr con = m_endpoint.get_con_from_hdl(m_hdl, ec);
+    if (ec) {
+        return 0;
+    }
+    return con->get_buffered_amount();
+}
+
+// WebSocket++ must not be asked to resume reading a connection which is not
+// paused: it would start a second read.
+void SmartDoorConnection::pause_reading() {
+    if (reading_paused) {
+        return;
+    }
+
+    websocketpp::lib::error_code ec;
+    m_endpoint.pause_reading(m_hdl, ec);
+    if (ec) {
+        spdlog::error("SmartDoorConnection: error pausing reading: " + ec.message());
         return;
     }
+    reading_paused = true;
+}
+
+void SmartDoorConnection::resume_reading() {
+    if (!reading_paused) {
+        return;
+    }
+
+    reading_paused = false;
+    websocketpp::lib::error_code ec;
+    m_endpoint.resume_reading(m_hdl, ec);
+    if (ec) {
+        spdlog::error("SmartDoorConnection: error resuming reading: " + ec.message());
+    }
+}
+
+void SmartDoorConnection::dump_statistics() {
+    std::lock_guard<std::mutex> lock(mark_mutex);
+    water_marks.dump_statistics("SmartDoorConnection");
+}
+
+void SmartDoorConnection::set_timer(long milliseconds, std::function<void()> callback) {
+    cancel_timer();
+    m_timer = m_endpoint.set_timer(milliseconds, lifetime_guard.wrap(
+        [callback](const websocketpp::lib::error_code& ec) {
+            if (!ec) {
+                callback();
+            }
+        }));
+}
+
+void SmartDoorConnection::cancel_timer() {
+    if (m_timer) {
+        m_timer->cancel();
+        m_timer.reset();
+    }
 }
 
 void SmartDoorConnection::on_socket_init(connection_hdl hdl) {
@@ -95,8 +231,8 @@ void SmartDoorConnection::on_socket_init(connection_hdl hdl) {
 void SmartDoorConnection::on_open(connection_hdl hdl) {
     spdlog::info("SmartDoorConnection::on_open");
     spdlog::info("SmartDoorConnection: connected to SUT: " + server_uri);
-    handler_ptr->send_reset_to_sut();
-    handler_ptr->send_ready_to_amp();
+    handler_ptr->dispatch(std::bind(&SmartDoorHandler::on_sut_connected,
+                                    handler_ptr, connection_id));
 }
 
 void SmartDoorConnection::on_close(connection_hdl hdl) {
@@ -118,18 +254,27 @@ void SmartDoorConnection::on_fail(connection_hdl hdl) {
     connection_ptr con = m_endpoint.get_con_from_hdl(hdl);
     std::string msg = con->get_ec().message();
     spdlog::error("Error message: " + msg);
+
+    if (handler_ptr != 0) {
+        handler_ptr->dispatch(std::bind(&SmartDoorHandler::on_sut_failed,
+                                        handler_ptr, connection_id));
+    }
 }
 
 // TODO: check that we only receive string messages
+// The response is processed on the thread of the AdapterCore; the payload is
+// moved into the event.
 void SmartDoorConnection::on_message(connection_hdl hdl, message_ptr msg) {
     // spdlog::info("SmartDoorConnection::on_message");
-    std::string message = msg->get_payload();
-    spdlog::info("SmartDoorConnection: received from SUT: " + message);
+    long receive_time = LatencyRecorder::now();
     if (handler_ptr != 0) {
-        handler_ptr->send_response_to_amp(message);
+        handler_ptr->dispatch(std::bind(&SmartDoorHandler::on_sut_message,
+            handler_ptr, connection_id, std::move(msg->get_raw_payload()), receive_time));
     }
 }
 
-void SmartDoorConnection::register_handler(SmartDoorHandler* handler_ptr) {
+void SmartDoorConnection::register_handler(SmartDoorHandler* handler_ptr,
+                                           unsigned long connection_id) {
     this->handler_ptr = handler_ptr;
+    this->connection_id = connection_id;
 }
@@ -3,6 +3,8 @@
 #ifndef SMARTDOOR_CONNECTION_HPP
 #define SMARTDOOR_CONNECTION_HPP
 
+#include <functional>
+#include <mutex>
 #include <string>
 
 #include <websocketpp/config/asio_no_tls_client.hpp>
@@ -12,6 +14,8 @@
 #include <websocketpp/common/memory.hpp>
 
 #include "smartdoor_handler.hpp"
+#include "lifetime_guard.hpp"
+#include "water_marks.hpp"
 
 typedef websocketpp::client<websocketpp::config::asio_client> client;
 typedef websocketpp::config::asio_client::message_type::ptr message_ptr;
@@ -19,16 +23,41 @@ typedef websocketpp::connection_hdl connection_hdl;
 typedef client::connection_ptr connection_ptr;
 
 // The SmartDoorConnection is responsible for the WebSocket connection to
-// standalone SmartDoor SUT.
+// standalone SmartDoor SUT. Like the BrokerConnection, it either runs its own
+// ASIO event loop in a background thread or attaches to an external io_service.
+//
+// Like the connection with AMP, the bytes buffered for the SUT are bounded by
+// WaterMarks: a crossing of a mark is reported to the handler, which lets the
+// AdapterCore pause reading stimuli from AMP.
 class SmartDoorConnection {
 public:
-    SmartDoorConnection(std::string uri);
+    SmartDoorConnection(std::string uri,
+                        websocketpp::lib::asio::io_service* io_service_ptr = 0);
     ~SmartDoorConnection();
 
     void connect();
     void close(int code, std::string message);
-    void send(std::string);
-    void register_handler(SmartDoorHandler* handler_ptr);
+    // Returns the (monotonic) time the message was handed to WebSocket++, or
+    // 0 if it could not be sent.
+    long send(const std::string& message);
+
+    // The number of bytes queued for the SUT, but not yet written to the socket.
+    size_t get_buffered_amount();
+
+    // Stop (and continue) reading messages from the SUT. Only to be used
+    // while the connection is open.
+    void pause_reading();
+    void resume_reading();
+    void dump_statistics();
+
+    // Call the callback after the given number of milliseconds, on the event
+    // loop of the connection. A new timer cancels the previous one; the
+    // callback is not called after the connection has been deleted.
+    void set_timer(long milliseconds, std::function<void()> callback);
+    void cancel_timer();
+    // The connection_id identifies this connection in the events for the
+    // handler, which may arrive after the handler has replaced the connection.
+    void register_handler(SmartDoorHandler* handler_ptr, unsigned long connection_id);
 
 private:
     void on_socket_init(connection_hdl hdl);
@@ -36,13 +65,22 @@ private:
     void on_close(connection_hdl hdl);
     void on_fail(connection_hdl hdl);
     void on_message(connection_hdl hdl, message_ptr msg);
+    void check_water_marks(bool draining);
 
 private:
     client m_endpoint;
     websocketpp::connection_hdl m_hdl;
     websocketpp::lib::shared_ptr<websocketpp::lib::thread> m_thread;
+    client::timer_ptr m_timer;
+    client::timer_ptr drain_timer;
+
+    std::mutex mark_mutex;
+    WaterMarks water_marks;
+    bool reading_paused;
+    LifetimeGuard lifetime_guard;  // of the callbacks run by the event loop
 
     SmartDoorHandler* handler_ptr;
+    unsigned long connection_id;
     std::string server_uri;
 };
 
@@ -1,18 +1,46 @@
 // Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
 
 #include "spdlog/spdlog.h"
+#include "logging.hpp"
 #include "adapter_core.hpp"
 #include "handler.hpp"
 #include "smartdoor_handler.hpp"
 #include "smartdoor_connection.hpp"
 #include "axini_protobuf.hpp"
+#include "clock.hpp"
+#include "env.hpp"
+#include "latency_histogram.hpp"
+#include "session_recorder.hpp"
+#include "stimulus_pacer.hpp"
+
+#include <cstdio>
 
 // We use boost for to_lower and to_upper.
 #include <boost/algorithm/string.hpp>
 
+static const ConfigurationKey URL_KEY("url");
+static const ConfigurationKey MANUFACTURER_KEY("manufacturer");
+
 SmartDoorHandler::SmartDoorHandler()
-    : smartdoor_connection_ptr(0) {
+    : SmartDoorHandler(SMARTDOOR_URL) {
+}
+
+// The sut_url is used as default value for the "url" configuration item.
+SmartDoorHandler::SmartDoorHandler(std::string sut_url,
+                                   boost::asio::io_service* io_service_ptr)
+    : sut_url(sut_url),
+      io_service_ptr(io_service_ptr),
+      smartdoor_connection_ptr(0),
+      connection_id(0),
+      reset_pending(false),
+      reset_time(0),
+      reset_id(0),
+      sut_connected(false),
+      reading_paused(false),
+      sut_backlog(false) {
+    reset_deadline = axini::env_long("ADAPTER_RESET_DEADLINE_MS", 2000);
     set_configuration(default_configuration());
+    build_converter_tables();
 }
 
 SmartDoorHandler::~SmartDoorHandler() {
@@ -30,12 +58,12 @@ void SmartDoorHandler::start() {
         stop();
     }
 
-    Configuration config = get_configuration();
-    std::string url = axini::get_string_value_from(config, "url");
+    std::shared_ptr<const ConfigurationSnapshot> snapshot_ptr = get_snapshot();
+    const std::string& url = snapshot_ptr->get_string(URL_KEY);
     spdlog::info("SmartDoorHandler: trying to connect to SUT @ " + url);
 
-    smartdoor_connection_ptr = new SmartDoorConnection(url);
-    smartdoor_connection_ptr->register_handler(this);
+    smartdoor_connection_ptr = new SmartDoorConnection(url, io_service_ptr);
+    smartdoor_connection_ptr->register_handler(this, ++connection_id);
     smartdoor_connection_ptr->connect();
 
     // TODO: add exception handling when things go wrong
@@ -45,9 +73,18 @@ void SmartDoorHandler::start() {
 // Stop testing.
 void SmartDoorHandler::stop() {
     spdlog::info("SmartDoorHandler::stop");
+    reset_pending = false;
+    sut_connected = false;
+    if (sut_backlog) {
+        // The buffered stimuli are dropped with the connection.
+        sut_backlog = false;
+        adapter_core_ptr->set_sut_backpressure(false);
+    }
     if (smartdoor_connection_ptr != 0) {
         smartdoor_connection_ptr->close(1000, "Adapter is stopped");
 
+        // The destructor waits for a callback of the connection which is
+        // running on another thread of the event loop.
         delete smartdoor_connection_ptr;
         smartdoor_connection_ptr = 0;
     }
@@ -59,52 +96,203 @@ void SmartDoorHandler::reset() {
     // Try to reuse the WebSocket connection to the SUT.
     if (smartdoor_connection_ptr != 0) {
         send_reset_to_sut();
-        send_ready_to_amp();
+        send_ready_after_reset();
     } else {
         stop();
         start();
     }
 }
 
-std::string SmartDoorHandler::stimulate(Label stimulus) {
-    spdlog::info("SmartDoorHandler::stimulate: " + axini::to_string(stimulus));
-    std::string sut_message = label_to_sut_message(stimulus);
-    smartdoor_connection_ptr->send(sut_message);
+bool SmartDoorHandler::is_started() {
+    return smartdoor_connection_ptr != 0;
+}
+
+std::string SmartDoorHandler::stimulate(const Label& stimulus, long& send_time) {
+    LOG_HOT_INFO("SmartDoorHandler::stimulate: {}", stimulus);
+    const std::string& sut_message = label_to_sut_message(stimulus);
+    send_time = smartdoor_connection_ptr->send(sut_message);
+    if (recorder_ptr != 0) {
+        recorder_ptr->record(TO_SUT, sut_message, send_time);
+    }
     return sut_message;
 }
 
+// Reading is paused only while the connection is open; a connection which
+// opens while reading is paused, is paused in on_sut_connected.
+void SmartDoorHandler::pause_reading() {
+    reading_paused = true;
+    if (sut_connected) {
+        smartdoor_connection_ptr->pause_reading();
+    }
+}
+
+void SmartDoorHandler::resume_reading() {
+    reading_paused = false;
+    if (sut_connected) {
+        smartdoor_connection_ptr->resume_reading();
+    }
+}
+
+void SmartDoorHandler::dump_statistics() {
+    if (smartdoor_connection_ptr != 0) {
+        smartdoor_connection_ptr->dump_statistics();
+    }
+}
+
 void SmartDoorHandler::send_reset_to_sut() {
     spdlog::info("SmartDoorHandler::send_reset_to_sut");
-    Configuration config = get_configuration();
-    std::string manufacturer = axini::get_string_value_from(config, "manufacturer");
-    std::string reset_string = RESET + ":" + manufacturer;
+    const std::string& reset_string = reset_to_sut_message();
     smartdoor_connection_ptr->send(reset_string);
     spdlog::info("SmartDoorHandler: sent " + reset_string + " to SUT");
+    if (recorder_ptr != 0) {
+        recorder_ptr->record(TO_SUT, reset_string, LatencyRecorder::now());
+    }
+
+    reset_pending = true;
+    reset_time = LatencyRecorder::now();
+    reset_id++;
+}
+
+void SmartDoorHandler::set_reset_deadline(long milliseconds) {
+    reset_deadline = milliseconds;
+}
+
+// Wait for RESET_PERFORMED before sending Ready, but not beyond the deadline.
+// The deadline is handled on the AdapterCore's thread, like the responses.
+void SmartDoorHandler::send_ready_after_reset() {
+    if (reset_deadline <= 0) {
+        reset_pending = false;
+        send_ready_to_amp();
+        return;
+    }
+
+    unsigned long connection_id = this->connection_id;
+    unsigned long reset_id = this->reset_id;
+    smartdoor_connection_ptr->set_timer(reset_deadline, [this, connection_id, reset_id]() {
+        dispatch(std::bind(&SmartDoorHandler::on_reset_deadline,
+                           this, connection_id, reset_id));
+    });
+}
+
+void SmartDoorHandler::on_reset_performed(long receive_time) {
+    if (!reset_pending) {
+        spdlog::info("SmartDoorHandler: " + RESET_PERFORMED + " received after the deadline");
+        return;
+    }
+
+    reset_pending = false;
+    smartdoor_connection_ptr->cancel_timer();
+    adapter_core_ptr->record_latency(SESSION_LATENCIES, RESET_ROUND_TRIP,
+                                     receive_time - reset_time);
+    spdlog::info("SmartDoorHandler: reset performed by SUT");
+    send_ready_to_amp();
+}
+
+// Fallback: the SUT did not acknowledge the reset in time.
+void SmartDoorHandler::on_reset_deadline(unsigned long connection_id, unsigned long reset_id) {
+    if (!reset_pending || connection_id != this->connection_id || reset_id != this->reset_id) {
+        return;
+    }
+
+    reset_pending = false;
+    spdlog::warn("SmartDoorHandler: no " + RESET_PERFORMED + " from SUT within " +
+                 std::to_string(reset_deadline) + " ms, sending Ready anyway");
+    send_ready_to_amp();
 }
 
-void SmartDoorHandler::send_response_to_amp(std::string message) {
-    spdlog::info("SmartDoorHandler::send_response_to_amp");
-    if (message != RESET_PERFORMED) {
-        Label label = sut_message_to_label(message);
-        long timestamp = axini::current_timestamp();
-        std::string physical_label = message;
-        adapter_core_ptr->send_response(label, physical_label, timestamp);
+// The connection with the SUT is open: reset the SUT and report Ready.
+// The connection may have been stopped or replaced in the meantime.
+void SmartDoorHandler::on_sut_connected(unsigned long connection_id) {
+    if (smartdoor_connection_ptr != 0 && connection_id == this->connection_id) {
+        sut_connected = true;
+        if (reading_paused) {
+            smartdoor_connection_ptr->pause_reading();
+        }
+        send_reset_to_sut();
+        send_ready_after_reset();
+    }
+}
+
+// The connection with the SUT could not be established: drop it, so that
+// the handler is no longer started.
+void SmartDoorHandler::on_sut_failed(unsigned long connection_id) {
+    if (smartdoor_connection_ptr != 0 && connection_id == this->connection_id) {
+        stop();
+    }
+}
+
+// The buffer of the connection with the SUT crossed a water mark. A crossing
+// of a connection which has been stopped or replaced, is ignored.
+void SmartDoorHandler::on_sut_backpressure(unsigned long connection_id, bool high) {
+    if (smartdoor_connection_ptr == 0 || connection_id != this->connection_id ||
+        high == sut_backlog) {
+        return;
+    }
+    sut_backlog = high;
+    adapter_core_ptr->set_sut_backpressure(high);
+}
+
+// There is only one connection at a time: its messages are responses. A
+// message still in flight from a connection which has been stopped or
+// replaced belongs to a previous test case, and is dropped.
+void SmartDoorHandler::on_sut_message(unsigned long connection_id, const std::string& message,
+                                      long receive_time) {
+    if (smartdoor_connection_ptr == 0 || connection_id != this->connection_id) {
+        return;
+    }
+    send_response_to_amp(message, receive_time);
+}
+
+// The receive_time is the (monotonic) time at which the message was received.
+void SmartDoorHandler::send_response_to_amp(const std::string& message, long receive_time) {
+    axini::sample_hot_path();
+    LOG_HOT_INFO("SmartDoorHandler::send_response_to_amp: {}", message);
+    if (recorder_ptr != 0) {
+        recorder_ptr->record(FROM_SUT, message, receive_time);
     }
+    if (is_reset_performed(message)) {
+        on_reset_performed(receive_time);
+    } else {
+        forward_response(message, receive_time);
+    }
+}
+
+void SmartDoorHandler::forward_response(const std::string& message, long receive_time) {
+    const Label& label = sut_message_to_label(message);
+    // The response is timestamped with the time it was received from the SUT.
+    long timestamp = axini::to_epoch_nanoseconds(receive_time);
+    std::string physical_label = message;
+    adapter_core_ptr->send_response(label, physical_label, timestamp, receive_time);
 }
 
 Configuration SmartDoorHandler::default_configuration() {
     Configuration configuration;
 
     Configuration_Item* item_url = configuration.add_items();
-    item_url->set_key("url");
+    item_url->set_key(URL_KEY.get_name());
     item_url->set_description("WebSocket URL of SmartDoor SUT");
-    item_url->set_string(SMARTDOOR_URL);
+    item_url->set_string(sut_url);
 
     Configuration_Item* item_manufacturer = configuration.add_items();
-    item_manufacturer->set_key("manufacturer");
+    item_manufacturer->set_key(MANUFACTURER_KEY.get_name());
     item_manufacturer->set_description("SmartDoor manufacturer to test");
     item_manufacturer->set_string(SMARTDOOR_MANUFACTURER);
 
+    Configuration_Item* item_rate = configuration.add_items();
+    item_rate->set_key(STIMULUS_RATE_KEY.get_name());
+    item_rate->set_description("Maximum stimuli per second per channel to the SUT (0: no limit)");
+    item_rate->set_float_(0);
+
+    Configuration_Item* item_burst = configuration.add_items();
+    item_burst->set_key(STIMULUS_BURST_KEY.get_name());
+    item_burst->set_description("Stimuli which may be sent at once, above the rate");
+    item_burst->set_integer(1);
+
+    Configuration_Item* item_queue = configuration.add_items();
+    item_queue->set_key(STIMULUS_QUEUE_KEY.get_name());
+    item_queue->set_description("Maximum stimuli waiting to be sent to the SUT");
+    item_queue->set_integer(1000);
+
     return configuration;
 }
 
@@ -151,33 +339,80 @@ std::vector<Label> SmartDoorHandler::get_supported_labels() {
 // SUT messages is simple (upper <-> lower). Hence, these converters
 // can be part of the SmartDoorHandler. For practical SUTs, we typically
 // introduce special classes for theses converters.
+//
+// The converters are table driven. The tables are built once from the
+// supported labels, so that converting a message does not need any
+// case conversion or string comparisons.
+
+void SmartDoorHandler::build_converter_tables() {
+    for (const Label& label : get_supported_labels()) {
+        std::string sut_name = boost::to_upper_copy(label.label());
+
+        if (label.type() == Label::STIMULUS) {
+            StimulusEncoder encoder;
+            encoder.prefix = sut_name;
+            encoder.parameter_type = NO_PARAMETER;
+            if (label.parameters_size() > 0) {
+                encoder.prefix += ":";
+                encoder.parameter_type = label.parameters(0).value().has_integer() ?
+                    INTEGER_PARAMETER : STRING_PARAMETER;
+            }
+            stimulus_encoders[label.label()] = encoder;
+        } else {
+            response_labels[sut_name] = label;
+        }
+    }
+}
 
-// Message to label converter.
-Label SmartDoorHandler::sut_message_to_label(std::string message) {
-    std::string response_message = boost::to_lower_copy(message);
-    return axini::response(response_message, "door");
-}
-
-// Label to message converter.
-std::string SmartDoorHandler::label_to_sut_message(Label stimulus) {
-    std::string label_name = stimulus.label();
-    std::string sut_message = boost::to_upper_copy(label_name);
-    std::string result;
-
-    if (label_name == "open" || label_name == "close") {
-        result = sut_message;
-    } else if (label_name == "lock" || label_name == "unlock") {
-        const Label_Parameter param = stimulus.parameters(0);
-        long passcode = param.value().integer();
-        result = sut_message + ":" + std::to_string(passcode);
-    } else if (label_name == "reset") {
-        const Label_Parameter param = stimulus.parameters(0);
-        std::string manufacturer = param.value().string();
-        result = sut_message + ":" + manufacturer;
-    } else {
+// Message to label converter. The returned label is owned by the handler.
+const Label& SmartDoorHandler::sut_message_to_label(const std::string& message) {
+    std::unordered_map<std::string, Label>::const_iterator it =
+        response_labels.find(message);
+    if (it != response_labels.end()) {
+        return it->second;
+    }
+
+    // Unknown response: pass it on to AMP.
+    unknown_response = axini::response(boost::to_lower_copy(message), "door");
+    return unknown_response;
+}
+
+const std::string& SmartDoorHandler::reset_to_sut_message() {
+    std::shared_ptr<const ConfigurationSnapshot> snapshot_ptr = get_snapshot();
+    const std::string& manufacturer = snapshot_ptr->get_string(MANUFACTURER_KEY);
+    reset_message.assign(RESET).append(":").append(manufacturer);
+    return reset_message;
+}
+
+bool SmartDoorHandler::is_reset_performed(const std::string& message) {
+    return message == RESET_PERFORMED;
+}
+
+// Label to message converter. The SUT message is written into a buffer which
+// is reused for all stimuli.
+const std::string& SmartDoorHandler::label_to_sut_message(const Label& stimulus) {
+    std::unordered_map<std::string, StimulusEncoder>::const_iterator it =
+        stimulus_encoders.find(stimulus.label());
+
+    if (it == stimulus_encoders.end()) {
         // This allows to send bad weather stimuli to the SUT.
-        result = sut_message;
+        sut_message = boost::to_upper_copy(stimulus.label());
+        return sut_message;
+    }
+
+    const StimulusEncoder& encoder = it->second;
+    sut_message.assign(encoder.prefix);
+
+    if (encoder.parameter_type != NO_PARAMETER && stimulus.parameters_size() > 0) {
+        const Label_Parameter_Value& value = stimulus.parameters(0).value();
+        if (encoder.parameter_type == INTEGER_PARAMETER) {
+            char digits[24];
+            int length = snprintf(digits, sizeof(digits), "%lld", (long long) value.integer());
+            sut_message.append(digits, length);
+        } else {
+            sut_message.append(value.string());
+        }
     }
 
-    return result;
+    return sut_message;
 }
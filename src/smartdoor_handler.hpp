@@ -3,6 +3,10 @@
 #ifndef SMARTDOOR_HANDLER_HPP
 #define SMARTDOOR_HANDLER_HPP
 
+#include <unordered_map>
+
+#include <boost/asio/io_service.hpp>
+
 #include "handler.hpp"
 #include "smartdoor_handler.hpp"
 
@@ -19,31 +23,95 @@ class SmartDoorConnection;
 
 // The SmartDoorHandler is a specific implementation of Handler for the
 // standalone SmartDoor SUT. The communication with the SUT is handled
-// by a separate SmartDoorConnection object.
+// by a separate SmartDoorConnection object. If an io_service is given, the
+// SmartDoorConnection runs on that io_service instead of its own thread.
+//
+// After a reset of the SUT, Ready is only sent to AMP when the SUT has
+// acknowledged the reset with RESET_PERFORMED, or, as a fallback, when the
+// reset deadline has passed. With a deadline of 0, Ready is sent right after
+// the reset has been sent (optimistic).
 
 class SmartDoorHandler: public Handler {
 public:
     SmartDoorHandler();
+    SmartDoorHandler(std::string sut_url,
+                     boost::asio::io_service* io_service_ptr = 0);
     ~SmartDoorHandler();
 
     void start();
     void stop();
     void reset();
+    bool is_started();
 
-    std::string stimulate(Label stimulus);
+    std::string stimulate(const Label& stimulus, long& send_time);
+
+    void pause_reading();
+    void resume_reading();
+    void dump_statistics();
 
     Configuration default_configuration();
     std::vector<Label> get_supported_labels();
 
-    void send_response_to_amp(std::string message);
+    // The events of the SmartDoorConnection with the given connection_id.
+    virtual void on_sut_connected(unsigned long connection_id);
+    virtual void on_sut_failed(unsigned long connection_id);
+    virtual void on_sut_backpressure(unsigned long connection_id, bool high);
+    virtual void on_sut_message(unsigned long connection_id, const std::string& message,
+                                long receive_time);
+
+    void send_response_to_amp(const std::string& message, long receive_time);
     void send_reset_to_sut();
 
+    void set_reset_deadline(long milliseconds);
+
+protected:
+    // Send the response of the SUT to AMP, as a Label.
+    void forward_response(const std::string& message, long receive_time);
+
+    // The converters between Labels and SUT messages. A subclass may
+    // override them for another line-oriented SUT (see TextProtocolHandler).
+    virtual const Label&       sut_message_to_label(const std::string& message);
+    virtual const std::string& label_to_sut_message(const Label& stimulus);
+    virtual const std::string& reset_to_sut_message();
+    virtual bool               is_reset_performed(const std::string& message);
+
+    std::string               sut_url;
+    boost::asio::io_service*  io_service_ptr;
+    long                      reset_deadline;  // milliseconds
+
 private:
-    static Label       sut_message_to_label(std::string message);
-    static std::string label_to_sut_message(Label stimulus);
+    void               send_ready_after_reset();
+    void               on_reset_performed(long receive_time);
+    void               on_reset_deadline(unsigned long connection_id, unsigned long reset_id);
+
+    void               build_converter_tables();
 
 private:
-    SmartDoorConnection* smartdoor_connection_ptr;
+    enum ParameterType { NO_PARAMETER, INTEGER_PARAMETER, STRING_PARAMETER };
+
+    // How to encode a stimulus: the SUT message starts with the prefix,
+    // followed by the value of the first parameter (if any).
+    struct StimulusEncoder {
+        std::string    prefix;
+        ParameterType  parameter_type;
+    };
+
+    SmartDoorConnection*      smartdoor_connection_ptr;
+    unsigned long             connection_id;  // of the current connection
+
+    bool                      reset_pending;
+    long                      reset_time;
+    unsigned long             reset_id;        // of the last reset sent
+
+    bool                      sut_connected;   // the current connection is open
+    bool                      reading_paused;
+    bool                      sut_backlog;     // above the high water mark
+
+    std::unordered_map<std::string, StimulusEncoder>  stimulus_encoders;
+    std::unordered_map<std::string, Label>            response_labels;
+    std::string                                       sut_message;
+    std::string                                       reset_message;
+    Label                                             unknown_response;
 };
 
 #endif // SMARTDOOR_HANDLER_HPP
@@ -0,0 +1,355 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <cstdio>
+#include <sstream>
+
+#include "spdlog/spdlog.h"
+#include "logging.hpp"
+#include "adapter_core.hpp"
+#include "smartdoor_pool_handler.hpp"
+#include "smartdoor_connection.hpp"
+#include "latency_histogram.hpp"
+#include "session_recorder.hpp"
+
+static const ConfigurationKey URL_KEY("url");
+static const ConfigurationKey URLS_KEY("urls");
+
+static std::vector<std::string> split_urls(const std::string& urls) {
+    std::vector<std::string> result;
+    std::string list = urls;
+    for (char& c : list) {
+        if (c == ',') {
+            c = ' ';
+        }
+    }
+    std::istringstream stream(list);
+    std::string url;
+    while (stream >> url) {
+        result.push_back(url);
+    }
+    return result;
+}
+
+static std::string first_url(const std::string& urls) {
+    std::vector<std::string> list = split_urls(urls);
+    return list.empty() ? SMARTDOOR_URL : list[0];
+}
+
+// The first url is the default value of the "url" configuration item.
+SmartDoorPoolHandler::SmartDoorPoolHandler(const std::string& sut_urls,
+                                           boost::asio::io_service* io_service_ptr)
+    : SmartDoorHandler(first_url(sut_urls), io_service_ptr),
+      sut_urls(sut_urls),
+      last_connection_id(0),
+      active_id(0),
+      ready_pending(false),
+      replicas_paused(false),
+      active_backlog(false),
+      n_swaps(0),
+      n_waits(0),
+      n_dropped(0) {
+    set_configuration(default_configuration());
+}
+
+SmartDoorPoolHandler::~SmartDoorPoolHandler() {
+    for (Replica& replica : replicas) {
+        delete replica.connection_ptr;
+    }
+}
+
+// Connect to all replicas; Ready is sent when the first one has been reset.
+// Without urls, the pool consists of the SUT at "url".
+void SmartDoorPoolHandler::start() {
+    spdlog::info("SmartDoorPoolHandler::start");
+    if (!replicas.empty()) {
+        stop();
+    }
+
+    std::shared_ptr<const ConfigurationSnapshot> snapshot_ptr = get_snapshot();
+    std::vector<std::string> urls = split_urls(snapshot_ptr->get_string(URLS_KEY));
+    if (urls.empty()) {
+        urls.push_back(snapshot_ptr->get_string(URL_KEY));
+    }
+
+    ready_pending = true;
+    for (const std::string& url : urls) {
+        spdlog::info("SmartDoorPoolHandler: trying to connect to SUT replica @ " + url);
+        Replica replica;
+        replica.connection_ptr = new SmartDoorConnection(url, io_service_ptr);
+        replica.connection_id = ++last_connection_id;
+        replica.state = CONNECTING;
+        replica.reset_time = 0;
+        replica.reset_id = 0;
+        replica.connection_ptr->register_handler(this, replica.connection_id);
+        replicas.push_back(replica);
+    }
+    for (Replica& replica : replicas) {
+        replica.connection_ptr->connect();
+    }
+}
+
+void SmartDoorPoolHandler::stop() {
+    spdlog::info("SmartDoorPoolHandler::stop");
+    release_backlog();
+    for (Replica& replica : replicas) {
+        replica.connection_ptr->close(1000, "Adapter is stopped");
+        delete replica.connection_ptr;
+    }
+    replicas.clear();
+    active_id = 0;
+    ready_pending = false;
+}
+
+// Swap the active replica for an idle one (the next in the pool, round robin)
+// and reset the one which was active in the background.
+void SmartDoorPoolHandler::reset() {
+    spdlog::info("SmartDoorPoolHandler::reset");
+    if (replicas.empty()) {
+        start();
+        return;
+    }
+
+    Replica* stale_ptr = find_replica(active_id);
+    active_id = 0;
+    release_backlog();
+
+    Replica* idle_ptr = find_idle_replica(stale_ptr != 0 ? stale_ptr->connection_id : 0);
+    if (idle_ptr != 0) {
+        n_swaps++;
+        activate(idle_ptr);
+    } else {
+        n_waits++;
+        ready_pending = true;
+    }
+
+    if (stale_ptr != 0) {
+        reset_replica(stale_ptr);
+    }
+}
+
+bool SmartDoorPoolHandler::is_started() {
+    return !replicas.empty();
+}
+
+std::string SmartDoorPoolHandler::stimulate(const Label& stimulus, long& send_time) {
+    LOG_HOT_INFO("SmartDoorPoolHandler::stimulate: {}", stimulus);
+    Replica* replica_ptr = find_replica(active_id);
+    if (replica_ptr == 0) {
+        spdlog::error("SmartDoorPoolHandler: no active SUT replica for the stimulus");
+        send_time = 0;
+        return "";
+    }
+
+    const std::string& sut_message = label_to_sut_message(stimulus);
+    send_time = replica_ptr->connection_ptr->send(sut_message);
+    if (recorder_ptr != 0) {
+        recorder_ptr->record(TO_SUT, sut_message, send_time);
+    }
+    return sut_message;
+}
+
+// All open replicas are paused: the resets of the idle replicas are answered
+// when reading continues.
+void SmartDoorPoolHandler::pause_reading() {
+    replicas_paused = true;
+    for (Replica& replica : replicas) {
+        if (replica.state != CONNECTING) {
+            replica.connection_ptr->pause_reading();
+        }
+    }
+}
+
+void SmartDoorPoolHandler::resume_reading() {
+    replicas_paused = false;
+    for (Replica& replica : replicas) {
+        if (replica.state != CONNECTING) {
+            replica.connection_ptr->resume_reading();
+        }
+    }
+}
+
+void SmartDoorPoolHandler::dump_statistics() {
+    for (Replica& replica : replicas) {
+        replica.connection_ptr->dump_statistics();
+    }
+    char line[256];
+    snprintf(line, sizeof(line),
+        "SmartDoorPoolHandler: %lu replicas, %lu resets swapped to a reset replica, "
+        "%lu resets waited for a replica, %lu responses of swapped out replicas dropped",
+        (unsigned long) replicas.size(), n_swaps, n_waits, n_dropped);
+    spdlog::info(line);
+}
+
+Configuration SmartDoorPoolHandler::default_configuration() {
+    Configuration configuration = SmartDoorHandler::default_configuration();
+
+    Configuration_Item* item_urls = configuration.add_items();
+    item_urls->set_key(URLS_KEY.get_name());
+    item_urls->set_description(
+        "WebSocket URLs of identical SmartDoor SUTs, separated by spaces (empty: url)");
+    item_urls->set_string(sut_urls);
+
+    return configuration;
+}
+
+void SmartDoorPoolHandler::on_sut_connected(unsigned long connection_id) {
+    Replica* replica_ptr = find_replica(connection_id);
+    if (replica_ptr == 0) {
+        return;
+    }
+    if (replicas_paused) {
+        replica_ptr->connection_ptr->pause_reading();
+    }
+    reset_replica(replica_ptr);
+}
+
+// A replica which cannot be reached is dropped from the pool. The handler is
+// no longer started when no replica is left.
+void SmartDoorPoolHandler::on_sut_failed(unsigned long connection_id) {
+    std::vector<Replica>::iterator it;
+    for (it = replicas.begin(); it != replicas.end(); ++it) {
+        if (it->connection_id == connection_id) {
+            break;
+        }
+    }
+    if (it == replicas.end()) {
+        return;
+    }
+
+    spdlog::error("SmartDoorPoolHandler: dropping an unreachable SUT replica");
+    if (connection_id == active_id) {
+        active_id = 0;
+        release_backlog();
+    }
+    delete it->connection_ptr;
+    replicas.erase(it);
+    if (replicas.empty()) {
+        spdlog::error("SmartDoorPoolHandler: no SUT replica left");
+        stop();
+    }
+}
+
+// Only the buffer of the active replica holds stimuli of the current test case.
+void SmartDoorPoolHandler::on_sut_backpressure(unsigned long connection_id, bool high) {
+    if (connection_id != active_id || high == active_backlog) {
+        return;
+    }
+    active_backlog = high;
+    adapter_core_ptr->set_sut_backpressure(high);
+}
+
+void SmartDoorPoolHandler::on_sut_message(unsigned long connection_id,
+                                          const std::string& message, long receive_time) {
+    axini::sample_hot_path();
+    LOG_HOT_INFO("SmartDoorPoolHandler::on_sut_message: {}", message);
+    Replica* replica_ptr = find_replica(connection_id);
+    if (replica_ptr == 0) {
+        return;
+    }
+    if (recorder_ptr != 0) {
+        recorder_ptr->record(FROM_SUT, message, receive_time);
+    }
+
+    if (is_reset_performed(message)) {
+        if (replica_ptr->state != RESETTING) {
+            spdlog::info("SmartDoorPoolHandler: " + RESET_PERFORMED + " received after the deadline");
+            return;
+        }
+        replica_ptr->connection_ptr->cancel_timer();
+        adapter_core_ptr->record_latency(SESSION_LATENCIES, RESET_ROUND_TRIP,
+                                         receive_time - replica_ptr->reset_time);
+        on_replica_reset(replica_ptr);
+    } else if (replica_ptr->state == ACTIVE) {
+        forward_response(message, receive_time);
+    } else {
+        n_dropped++;
+    }
+}
+
+SmartDoorPoolHandler::Replica* SmartDoorPoolHandler::find_replica(unsigned long connection_id) {
+    for (Replica& replica : replicas) {
+        if (replica.connection_id == connection_id) {
+            return &replica;
+        }
+    }
+    return 0;
+}
+
+// The replicas are tried in order, starting after the given one.
+SmartDoorPoolHandler::Replica* SmartDoorPoolHandler::find_idle_replica(
+        unsigned long after_connection_id) {
+    size_t start = 0;
+    for (size_t i = 0; i < replicas.size(); i++) {
+        if (replicas[i].connection_id == after_connection_id) {
+            start = i + 1;
+        }
+    }
+    for (size_t i = 0; i < replicas.size(); i++) {
+        Replica& replica = replicas[(start + i) % replicas.size()];
+        if (replica.state == IDLE) {
+            return &replica;
+        }
+    }
+    return 0;
+}
+
+// As the SmartDoorHandler: the replica is reset when the SUT has acknowledged
+// the reset, or when the reset deadline has passed.
+void SmartDoorPoolHandler::reset_replica(Replica* replica_ptr) {
+    const std::string& reset_string = reset_to_sut_message();
+    replica_ptr->connection_ptr->send(reset_string);
+    if (recorder_ptr != 0) {
+        recorder_ptr->record(TO_SUT, reset_string, LatencyRecorder::now());
+    }
+
+    replica_ptr->state = RESETTING;
+    replica_ptr->reset_time = LatencyRecorder::now();
+    replica_ptr->reset_id++;
+
+    if (reset_deadline <= 0) {
+        on_replica_reset(replica_ptr);
+        return;
+    }
+
+    unsigned long connection_id = replica_ptr->connection_id;
+    unsigned long reset_id = replica_ptr->reset_id;
+    replica_ptr->connection_ptr->set_timer(reset_deadline, [this, connection_id, reset_id]() {
+        dispatch(std::bind(&SmartDoorPoolHandler::on_reset_deadline,
+                           this, connection_id, reset_id));
+    });
+}
+
+void SmartDoorPoolHandler::on_replica_reset(Replica* replica_ptr) {
+    replica_ptr->state = IDLE;
+    if (ready_pending) {
+        activate(replica_ptr);
+    }
+}
+
+void SmartDoorPoolHandler::on_reset_deadline(unsigned long connection_id,
+                                             unsigned long reset_id) {
+    Replica* replica_ptr = find_replica(connection_id);
+    if (replica_ptr == 0 || replica_ptr->state != RESETTING || replica_ptr->reset_id != reset_id) {
+        return;
+    }
+
+    spdlog::warn("SmartDoorPoolHandler: no " + RESET_PERFORMED + " from SUT replica within " +
+                 std::to_string(reset_deadline) + " ms, using it anyway");
+    on_replica_reset(replica_ptr);
+}
+
+void SmartDoorPoolHandler::activate(Replica* replica_ptr) {
+    replica_ptr->state = ACTIVE;
+    active_id = replica_ptr->connection_id;
+    ready_pending = false;
+    send_ready_to_amp();
+}
+
+// The stimuli buffered for a replica which is no longer active do not hold
+// up the stimuli for the next one.
+void SmartDoorPoolHandler::release_backlog() {
+    if (active_backlog) {
+        active_backlog = false;
+        adapter_core_ptr->set_sut_backpressure(false);
+    }
+}
@@ -0,0 +1,85 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef SMARTDOOR_POOL_HANDLER_HPP
+#define SMARTDOOR_POOL_HANDLER_HPP
+
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+
+#include "smartdoor_handler.hpp"
+
+// The SmartDoorPoolHandler tests a pool of identical SmartDoor SUTs (replicas),
+// listed in the "urls" configuration item, one of which is active at a time.
+// Replicas which are not active are reset in the background. On a reset, the
+// active replica is swapped for a replica which has already been reset, and
+// Ready is sent to AMP right away; the replica which was active is reset
+// asynchronously. The time of a reset is thus hidden behind the execution of
+// the next test case(s). If no replica has been reset yet, Ready is sent as
+// soon as one has.
+//
+// Only the responses of the active replica are sent to AMP: the responses of
+// a replica which has been swapped out belong to the previous test case and
+// are dropped. With a single url, the pool behaves like the SmartDoorHandler.
+class SmartDoorPoolHandler: public SmartDoorHandler {
+public:
+    // The sut_urls (separated by spaces or commas) are the default value of
+    // the "urls" configuration item.
+    SmartDoorPoolHandler(const std::string& sut_urls,
+                         boost::asio::io_service* io_service_ptr = 0);
+    ~SmartDoorPoolHandler();
+
+    void start();
+    void stop();
+    void reset();
+    bool is_started();
+
+    std::string stimulate(const Label& stimulus, long& send_time);
+
+    void pause_reading();
+    void resume_reading();
+    void dump_statistics();
+
+    Configuration default_configuration();
+
+    void on_sut_connected(unsigned long connection_id);
+    void on_sut_failed(unsigned long connection_id);
+    void on_sut_backpressure(unsigned long connection_id, bool high);
+    void on_sut_message(unsigned long connection_id, const std::string& message,
+                        long receive_time);
+
+private:
+    enum ReplicaState { CONNECTING, RESETTING, IDLE, ACTIVE };
+
+    struct Replica {
+        SmartDoorConnection*  connection_ptr;
+        unsigned long         connection_id;
+        ReplicaState          state;
+        long                  reset_time;
+        unsigned long         reset_id;   // of the last reset sent
+    };
+
+    Replica* find_replica(unsigned long connection_id);
+    Replica* find_idle_replica(unsigned long after_connection_id);
+    void     reset_replica(Replica* replica_ptr);
+    void     on_replica_reset(Replica* replica_ptr);
+    void     on_reset_deadline(unsigned long connection_id, unsigned long reset_id);
+    void     activate(Replica* replica_ptr);
+    void     release_backlog();
+
+private:
+    std::string            sut_urls;
+    std::vector<Replica>   replicas;
+    unsigned long          last_connection_id;
+    unsigned long          active_id;        // connection_id of the active replica, or 0
+    bool                   ready_pending;    // Ready is sent when a replica is reset
+    bool                   replicas_paused;
+    bool                   active_backlog;   // the active replica is above its high water mark
+
+    unsigned long          n_swaps;          // resets answered by an idle replica
+    unsigned long          n_waits;          // ... which had to wait for a reset
+    unsigned long          n_dropped;        // responses of swapped out replicas
+};
+
+#endif // SMARTDOOR_POOL_HANDLER_HPP
@@ -0,0 +1,351 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+
+#include "spdlog/spdlog.h"
+
+#include "stimulus_generator.hpp"
+#include "axini_protobuf.hpp"
+#include "handler.hpp"
+
+// Without progress for this long, the generator gives up waiting.
+static const long STALL_TIMEOUT = 5000000000L; // nanoseconds
+
+// The period of the timer which sends the stimuli in rate mode.
+static const long TICK_PERIOD = 1000000L; // nanoseconds
+
+static const int PASSCODE          = 1234;
+static const int OTHER_PASSCODE    = 4321;
+static const int TOO_LONG_PASSCODE = 12345;
+
+static boost::asio::steady_timer::duration nanoseconds(long ns) {
+    return std::chrono::duration_cast<boost::asio::steady_timer::duration>(
+        std::chrono::nanoseconds(ns > 0 ? ns : 0));
+}
+
+// The responses to good-weather stimuli; all other responses are errors.
+static bool is_error(const std::string& response) {
+    return response != "opened" && response != "closed" &&
+           response != "locked" && response != "unlocked";
+}
+
+static std::string serialize(const Message& message) {
+    std::string bytes;
+    message.SerializeToString(&bytes);
+    return bytes;
+}
+
+static std::string stimulus_message(const std::string& name, const std::string& channel,
+                                    int passcode = -1) {
+    std::vector<Label_Parameter> parameters;
+    if (passcode >= 0) {
+        parameters.push_back(axini::parameter("passcode", axini::parameter_value(passcode)));
+    }
+    return serialize(axini::message(axini::stimulus(name, channel, parameters)));
+}
+
+StimulusGenerator::Statistics::Statistics()
+    : n_sent(0),
+      n_responses(0) {
+}
+
+StimulusGenerator::StimulusGenerator(boost::asio::io_service* io_service_ptr,
+                                     AdapterCore* adapter_core_ptr, Handler* handler_ptr,
+                                     const GeneratorOptions& options)
+    : io_service_ptr(io_service_ptr),
+      adapter_core_ptr(adapter_core_ptr),
+      handler_ptr(handler_ptr),
+      options(options),
+      random(options.seed),
+      position(0),
+      running(false),
+      sending(false),
+      resetting(false),
+      start_time(0),
+      report_time(0),
+      progress_time(0),
+      n_scheduled(0),
+      n_throttled(0),
+      n_lost(0),
+      n_unexpected(0),
+      n_resets(0),
+      interval(new Statistics()),
+      tick_timer(*io_service_ptr),
+      report_timer(*io_service_ptr) {
+    build_messages();
+}
+
+// The stimuli are serialized once; they are sent on the channel of the
+// handler's "open" stimulus.
+void StimulusGenerator::build_messages() {
+    std::string channel = "door";
+    for (const Label& label : handler_ptr->get_supported_labels()) {
+        if (label.type() == Label::STIMULUS && label.label() == "open") {
+            channel = label.channel();
+        }
+    }
+
+    messages.resize(STIMULUS_COUNT);
+    messages[OPEN]             = stimulus_message("open", channel);
+    messages[CLOSE]            = stimulus_message("close", channel);
+    messages[LOCK]             = stimulus_message("lock", channel, PASSCODE);
+    messages[UNLOCK]           = stimulus_message("unlock", channel, PASSCODE);
+    messages[WRONG_PASSCODE]   = stimulus_message("unlock", channel, OTHER_PASSCODE);
+    messages[INVALID_PASSCODE] = stimulus_message("lock", channel, TOO_LONG_PASSCODE);
+    messages[UNKNOWN]          = stimulus_message("kick", channel);
+
+    Message reset;
+    reset.mutable_reset();
+    reset_message = serialize(reset);
+}
+
+// Open the session as AMP would: the announcement is dropped and the
+// handler's default configuration is sent, with the url of the SUT.
+void StimulusGenerator::start() {
+    progress_time = LatencyRecorder::now();
+    adapter_core_ptr->on_open();
+    configure();
+    schedule_report();
+}
+
+void StimulusGenerator::configure() {
+    Message message;
+    Configuration* configuration = message.mutable_configuration();
+    *configuration = handler_ptr->default_configuration();
+    for (int i = 0; i < configuration->items_size(); i++) {
+        if (configuration->items(i).key() == "url" && !options.sut_url.empty()) {
+            configuration->mutable_items(i)->set_string(options.sut_url);
+        }
+    }
+    adapter_core_ptr->handle_message(serialize(message), LatencyRecorder::now());
+}
+
+// The observer is called by the AdapterCore while it is sending to AMP: the
+// next stimuli are sent from a separate event.
+void StimulusGenerator::on_ready() {
+    io_service_ptr->post([this]() {
+        long now = LatencyRecorder::now();
+        progress_time = now;
+        if (resetting) {
+            resetting = false;
+            if (options.rate <= 0) {
+                fill_window();
+            }
+            return;
+        }
+        if (running) {
+            return;
+        }
+
+        spdlog::info("StimulusGenerator: the adapter is ready, generating stimuli");
+        running = true;
+        sending = true;
+        start_time = now;
+        report_time = now;
+        if (options.rate > 0) {
+            schedule_tick();
+        } else {
+            fill_window();
+        }
+    });
+}
+
+// The responses arrive in the order of the stimuli. Responses which arrive
+// after a shut off (while resetting) have no outstanding stimulus anymore.
+void StimulusGenerator::on_response(const Label& label, long receive_time) {
+    progress_time = LatencyRecorder::now();
+    if (outstanding.empty()) {
+        n_unexpected++;
+        return;
+    }
+
+    long latency = receive_time - outstanding.front();
+    outstanding.pop_front();
+    interval->n_responses++;
+    interval->latencies.record(latency);
+    total.n_responses++;
+    total.latencies.record(latency);
+
+    const std::string& response = label.label();
+    if (is_error(response)) {
+        interval->errors[response]++;
+        total.errors[response]++;
+    }
+
+    if (response == "shut_off") {
+        io_service_ptr->post(std::bind(&StimulusGenerator::send_reset, this));
+    } else if (options.rate <= 0) {
+        io_service_ptr->post(std::bind(&StimulusGenerator::fill_window, this));
+    }
+}
+
+void StimulusGenerator::send_stimulus() {
+    long now = LatencyRecorder::now();
+    outstanding.push_back(now);
+    interval->n_sent++;
+    total.n_sent++;
+    adapter_core_ptr->handle_message(messages[next_stimulus()], now);
+}
+
+// The stimuli which are still outstanding will not be answered.
+void StimulusGenerator::send_reset() {
+    if (resetting) {
+        return;
+    }
+    spdlog::info("StimulusGenerator: the SUT has shut off, resetting");
+    resetting = true;
+    n_resets++;
+    n_lost += outstanding.size();
+    outstanding.clear();
+    position = 0;
+    progress_time = LatencyRecorder::now();
+    adapter_core_ptr->handle_message(reset_message, progress_time);
+}
+
+StimulusGenerator::Stimulus StimulusGenerator::next_stimulus() {
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    if (options.bad_weather > 0 && chance(random) < options.bad_weather) {
+        switch (random() % 4) {
+        case 0:  return (Stimulus) ((position + 3) % 4);  // the previous stimulus again
+        case 1:  return WRONG_PASSCODE;
+        case 2:  return INVALID_PASSCODE;
+        default: return UNKNOWN;
+        }
+    }
+    Stimulus stimulus = (Stimulus) position;
+    position = (position + 1) % 4;
+    return stimulus;
+}
+
+// Closed loop: keep 'concurrency' stimuli outstanding until the duration
+// has passed.
+void StimulusGenerator::fill_window() {
+    if (sending && LatencyRecorder::now() - start_time >= options.duration * 1e9) {
+        sending = false;
+    }
+    while (sending && !resetting && (long) outstanding.size() < options.concurrency) {
+        send_stimulus();
+    }
+}
+
+void StimulusGenerator::schedule_tick() {
+    long period = (long) (1e9 / options.rate);
+    tick_timer.expires_from_now(nanoseconds(period < TICK_PERIOD ? period : TICK_PERIOD));
+    tick_timer.async_wait([this](const boost::system::error_code& ec) {
+        if (!ec) {
+            on_tick();
+        }
+    });
+}
+
+// Rate mode: send the stimuli which are due. A stimulus which is due while
+// 'concurrency' stimuli are outstanding (or while resetting) is skipped.
+void StimulusGenerator::on_tick() {
+    long elapsed = LatencyRecorder::now() - start_time;
+    if (elapsed >= options.duration * 1e9) {
+        sending = false;
+        return;
+    }
+
+    long due = (long) (elapsed * options.rate / 1e9);
+    for (; n_scheduled < due; n_scheduled++) {
+        if (!resetting && (long) outstanding.size() < options.concurrency) {
+            send_stimulus();
+        } else {
+            n_throttled++;
+        }
+    }
+    schedule_tick();
+}
+
+void StimulusGenerator::schedule_report() {
+    report_timer.expires_from_now(nanoseconds((long) (options.interval * 1e9)));
+    report_timer.async_wait([this](const boost::system::error_code& ec) {
+        if (!ec) {
+            on_report();
+        }
+    });
+}
+
+void StimulusGenerator::on_report() {
+    long now = LatencyRecorder::now();
+    bool stalled = now - progress_time > STALL_TIMEOUT;
+
+    if (!running || resetting) {
+        if (stalled) {
+            std::cerr << "generator: the adapter did not become ready" << std::endl;
+            finish();
+        } else {
+            schedule_report();
+        }
+        return;
+    }
+
+    if (stalled && !outstanding.empty()) {
+        std::cerr << "generator: no response from the SUT for "
+                  << STALL_TIMEOUT / 1000000000L << " s" << std::endl;
+        n_lost += outstanding.size();
+        outstanding.clear();
+        progress_time = now;
+        if (options.rate <= 0) {
+            fill_window();
+        }
+    }
+
+    char title[32];
+    snprintf(title, sizeof(title), "%.1f s", (now - start_time) / 1e9);
+    report(title, *interval, (now - report_time) / 1e9);
+    interval.reset(new Statistics());
+    report_time = now;
+
+    if (!sending && outstanding.empty()) {
+        finish();
+        return;
+    }
+    schedule_report();
+}
+
+void StimulusGenerator::finish() {
+    double elapsed = running ? (LatencyRecorder::now() - start_time) / 1e9 : 0;
+    std::cout << "stimuli sent:         " << total.n_sent << " in " << elapsed << " s"
+              << std::endl
+              << "responses:            " << total.n_responses << " (lost: " << n_lost
+              << ", unexpected: " << n_unexpected << ")" << std::endl;
+    if (options.rate > 0) {
+        std::cout << "skipped:              " << n_throttled
+                  << " (too many outstanding stimuli)" << std::endl;
+    }
+    std::cout << "resets:               " << n_resets << std::endl;
+    report("total", total, elapsed);
+
+    tick_timer.cancel();
+    report_timer.cancel();
+    handler_ptr->stop();
+    io_service_ptr->stop();
+}
+
+// One line: the rates, the response latencies and the error responses.
+void StimulusGenerator::report(const std::string& title, const Statistics& statistics,
+                               double seconds) {
+    char line[256];
+    snprintf(line, sizeof(line),
+        "%-8s sent=%ld (%.0f/s) responses=%ld (%.0f/s) "
+        "p50=%.1f p99=%.1f p99.9=%.1f max=%.1f us",
+        title.c_str(),
+        statistics.n_sent, seconds > 0 ? statistics.n_sent / seconds : 0.0,
+        statistics.n_responses, seconds > 0 ? statistics.n_responses / seconds : 0.0,
+        statistics.latencies.get_percentile(50.0) / 1000.0,
+        statistics.latencies.get_percentile(99.0) / 1000.0,
+        statistics.latencies.get_percentile(99.9) / 1000.0,
+        statistics.latencies.get_max() / 1000.0);
+    std::cout << line;
+
+    std::map<std::string, long>::const_iterator it;
+    for (it = statistics.errors.begin(); it != statistics.errors.end(); ++it) {
+        std::cout << " " << it->first << "=" << it->second;
+    }
+    std::cout << std::endl;
+}
@@ -0,0 +1,124 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef STIMULUS_GENERATOR_HPP
+#define STIMULUS_GENERATOR_HPP
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "adapter_core.hpp"
+#include "latency_histogram.hpp"
+
+class Handler;
+
+struct GeneratorOptions {
+    std::string  sut_url;
+    double       rate;         // stimuli per second, 0: closed loop
+    long         concurrency;  // (maximum) number of outstanding stimuli
+    double       duration;     // seconds
+    double       bad_weather;  // fraction of bad-weather stimuli
+    double       interval;     // seconds between two reports
+    unsigned     seed;
+};
+
+// The StimulusGenerator plays AMP, to find the capacity of the SUT and of the
+// adapter: it configures the adapter and then generates stimuli, faster than
+// AMP would. The stimuli are injected into a real AdapterCore (without a
+// BrokerConnection), which offers them to the SUT through the Handler's
+// stimulate. The responses are observed as they are sent to AMP.
+//
+// The good-weather stimuli open, close, lock and unlock follow each other
+// (the door is expected to be closed and unlocked after a reset). A fraction
+// of the stimuli is replaced by bad weather: the previous stimulus again, an
+// unlock with a wrong passcode, a lock with an invalid passcode, or an
+// unknown stimulus. The responses are counted, not checked. When the SUT
+// shuts off, it is reset and the generator waits for Ready.
+//
+// The stimuli are either sent in a closed loop, with a fixed number of
+// outstanding stimuli, or at a fixed rate, with at most 'concurrency'
+// outstanding stimuli. The SUT answers the stimuli in order, so the n-th
+// response belongs to the n-th outstanding stimulus.
+//
+// Every interval, the achieved rate, the percentiles of the response latency
+// (from injecting a stimulus until receiving its response from the SUT) and
+// the error responses are reported, and at the end a summary of the run.
+class StimulusGenerator : public AdapterObserver {
+public:
+    StimulusGenerator(boost::asio::io_service* io_service_ptr, AdapterCore* adapter_core_ptr,
+                      Handler* handler_ptr, const GeneratorOptions& options);
+
+    void start();
+
+    void on_ready();
+    void on_response(const Label& label, long receive_time);
+
+private:
+    enum Stimulus { OPEN, CLOSE, LOCK, UNLOCK, WRONG_PASSCODE, INVALID_PASSCODE, UNKNOWN,
+                    STIMULUS_COUNT };
+
+    // The counters of a report interval, or of the whole run.
+    struct Statistics {
+        Statistics();
+
+        long                         n_sent;
+        long                         n_responses;
+        std::map<std::string, long>  errors;   // per response
+        LatencyHistogram             latencies;
+    };
+
+    void build_messages();
+    void configure();
+
+    void send_stimulus();
+    void send_reset();
+    Stimulus next_stimulus();
+    void fill_window();
+
+    void schedule_tick();
+    void on_tick();
+    void schedule_report();
+    void on_report();
+    void finish();
+
+    void report(const std::string& title, const Statistics& statistics, double seconds);
+
+private:
+    boost::asio::io_service*  io_service_ptr;
+    AdapterCore*              adapter_core_ptr;
+    Handler*                  handler_ptr;
+    GeneratorOptions          options;
+
+    std::vector<std::string>  messages;     // [Stimulus], serialized
+    std::string               reset_message;
+    std::minstd_rand          random;
+    int                       position;     // in the good-weather cycle
+
+    bool                      running;
+    bool                      sending;      // until the duration has passed
+    bool                      resetting;    // waiting for Ready after a reset
+    long                      start_time;
+    long                      report_time;  // start of the report interval
+    long                      progress_time;
+    long                      n_scheduled;  // rate mode: stimuli due so far
+    long                      n_throttled;  // ... not sent: too many outstanding
+    long                      n_lost;       // without a response
+    long                      n_unexpected; // responses without a stimulus
+    long                      n_resets;
+
+    std::deque<long>          outstanding;  // the send times of the stimuli
+
+    std::unique_ptr<Statistics>  interval;
+    Statistics                   total;
+
+    boost::asio::steady_timer  tick_timer;
+    boost::asio::steady_timer  report_timer;
+};
+
+#endif // STIMULUS_GENERATOR_HPP
@@ -0,0 +1,194 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <chrono>
+#include <cstdio>
+
+#include "spdlog/spdlog.h"
+
+#include "stimulus_pacer.hpp"
+#include "adapter_core.hpp"
+#include "latency_histogram.hpp"
+
+const ConfigurationKey STIMULUS_RATE_KEY("stimulus_rate");
+const ConfigurationKey STIMULUS_BURST_KEY("stimulus_burst");
+const ConfigurationKey STIMULUS_QUEUE_KEY("stimulus_queue");
+
+// ----- TokenBucket
+
+// The bucket starts full.
+TokenBucket::TokenBucket(double rate, double burst, long now)
+    : rate(rate / 1e9),
+      burst(burst),
+      tokens(burst),
+      last_time(now) {
+}
+
+void TokenBucket::refill(long now) {
+    if (now > last_time) {
+        tokens += (now - last_time) * rate;
+        if (tokens > burst) {
+            tokens = burst;
+        }
+        last_time = now;
+    }
+}
+
+bool TokenBucket::take(long now) {
+    refill(now);
+    if (tokens < 1.0) {
+        return false;
+    }
+    tokens -= 1.0;
+    return true;
+}
+
+long TokenBucket::next_token_time(long now) {
+    refill(now);
+    if (tokens >= 1.0) {
+        return now;
+    }
+    return now + (long) ((1.0 - tokens) / rate) + 1;
+}
+
+// ----- StimulusPacer
+
+StimulusPacer::Channel::Channel(double rate, double burst, long now)
+    : bucket(rate, burst, now) {
+}
+
+StimulusPacer::StimulusPacer(boost::asio::io_service* io_service_ptr)
+    : io_service_ptr(io_service_ptr),
+      adapter_core_ptr(0),
+      timer(*io_service_ptr),
+      timer_armed(false),
+      rate(0),
+      burst(1),
+      queue_limit(0),
+      n_waiting(0),
+      n_paced(0),
+      n_rejected(0),
+      n_dropped(0),
+      max_waiting(0) {
+}
+
+void StimulusPacer::register_adapter_core(AdapterCore* adapter_core_ptr) {
+    this->adapter_core_ptr = adapter_core_ptr;
+}
+
+// The buckets are created (full) with the new rate when they are first used.
+void StimulusPacer::configure(double rate, long burst, size_t queue_limit) {
+    clear();
+    channels.clear();
+    this->rate = (rate > 0) ? rate : 0;
+    this->burst = (burst > 1) ? burst : 1;
+    this->queue_limit = queue_limit;
+    if (is_enabled()) {
+        spdlog::info("StimulusPacer: {} stimuli/s per channel, burst {}, queue {}",
+                     this->rate, this->burst, queue_limit);
+    }
+}
+
+bool StimulusPacer::is_enabled() {
+    return rate > 0;
+}
+
+StimulusPacer::Channel& StimulusPacer::get_channel(const std::string& channel, long now) {
+    std::unordered_map<std::string, Channel>::iterator it = channels.find(channel);
+    if (it == channels.end()) {
+        it = channels.insert(std::make_pair(channel, Channel(rate, burst, now))).first;
+    }
+    return it->second;
+}
+
+bool StimulusPacer::try_send(const std::string& channel, long now) {
+    Channel& paced_channel = get_channel(channel, now);
+    return paced_channel.waiting.empty() && paced_channel.bucket.take(now);
+}
+
+bool StimulusPacer::enqueue(const std::string& channel, std::function<void()> send) {
+    if (n_waiting >= queue_limit) {
+        n_rejected++;
+        return false;
+    }
+
+    long now = LatencyRecorder::now();
+    get_channel(channel, now).waiting.push_back(send);
+    n_waiting++;
+    n_paced++;
+    if (n_waiting > max_waiting) {
+        max_waiting = n_waiting;
+    }
+    schedule_release(now);
+    return true;
+}
+
+size_t StimulusPacer::clear() {
+    size_t n_cleared = n_waiting;
+    std::unordered_map<std::string, Channel>::iterator it;
+    for (it = channels.begin(); it != channels.end(); ++it) {
+        it->second.waiting.clear();
+    }
+    n_waiting = 0;
+    n_dropped += n_cleared;
+    timer.cancel();
+    timer_armed = false;
+    return n_cleared;
+}
+
+// Wake up when the first waiting stimulus gets a token.
+void StimulusPacer::schedule_release(long now) {
+    if (timer_armed) {
+        return;
+    }
+
+    long release_time = -1;
+    std::unordered_map<std::string, Channel>::iterator it;
+    for (it = channels.begin(); it != channels.end(); ++it) {
+        if (!it->second.waiting.empty()) {
+            long token_time = it->second.bucket.next_token_time(now);
+            if (release_time < 0 || token_time < release_time) {
+                release_time = token_time;
+            }
+        }
+    }
+    if (release_time < 0) {
+        return;
+    }
+
+    timer_armed = true;
+    timer.expires_from_now(std::chrono::nanoseconds(release_time - now));
+    timer.async_wait([this](const boost::system::error_code& ec) {
+        if (!ec) {
+            adapter_core_ptr->dispatch(std::bind(&StimulusPacer::release, this));
+        }
+    });
+}
+
+// Send the waiting stimuli for which there are tokens, in order per channel.
+void StimulusPacer::release() {
+    timer_armed = false;
+    long now = LatencyRecorder::now();
+    std::unordered_map<std::string, Channel>::iterator it;
+    for (it = channels.begin(); it != channels.end(); ++it) {
+        std::deque<std::function<void()> >& waiting = it->second.waiting;
+        while (!waiting.empty() && it->second.bucket.take(now)) {
+            std::function<void()> send = waiting.front();
+            waiting.pop_front();
+            n_waiting--;
+            send();
+        }
+    }
+    schedule_release(now);
+}
+
+void StimulusPacer::dump_statistics() {
+    if (!is_enabled()) {
+        return;
+    }
+    char line[256];
+    snprintf(line, sizeof(line),
+        "StimulusPacer: %lu stimuli paced (max %lu waiting), %lu rejected (queue full), "
+        "%lu dropped",
+        n_paced, (unsigned long) max_waiting, n_rejected, n_dropped);
+    spdlog::info(line);
+}
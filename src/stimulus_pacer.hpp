@@ -0,0 +1,107 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef STIMULUS_PACER_HPP
+#define STIMULUS_PACER_HPP
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "configuration_snapshot.hpp"
+
+class AdapterCore;
+
+// The configuration items of the pacing: the rate of the stimuli per channel
+// in stimuli per second (0: no pacing), the burst in stimuli, and the maximum
+// number of stimuli which may be waiting.
+extern const ConfigurationKey STIMULUS_RATE_KEY;
+extern const ConfigurationKey STIMULUS_BURST_KEY;
+extern const ConfigurationKey STIMULUS_QUEUE_KEY;
+
+// A TokenBucket allows 'rate' events per second on average, with bursts of
+// at most 'burst' events. Times are monotonic, in nanoseconds.
+class TokenBucket {
+public:
+    TokenBucket(double rate, double burst, long now);
+
+    // Takes a token if one is available.
+    bool take(long now);
+
+    // The time at which a token will be available.
+    long next_token_time(long now);
+
+private:
+    void refill(long now);
+
+    double  rate;       // tokens per nanosecond
+    double  burst;
+    double  tokens;
+    long    last_time;
+};
+
+// The StimulusPacer sits between the AdapterCore and the Handler, so that a
+// burst of stimuli from AMP does not overwhelm the SUT. Every channel has its
+// own TokenBucket. A stimulus that cannot be sent right away waits in the
+// queue of its channel, in order, until its bucket has a token; the queues
+// together hold at most 'queue_limit' stimuli.
+//
+// The pacer is used on the AdapterCore's WorkQueue only: its timer dispatches
+// the release of the waiting stimuli to the AdapterCore.
+class StimulusPacer {
+public:
+    StimulusPacer(boost::asio::io_service* io_service_ptr);
+
+    void register_adapter_core(AdapterCore* adapter_core_ptr);
+
+    // A rate of 0 disables the pacing. Waiting stimuli are dropped.
+    void configure(double rate, long burst, size_t queue_limit);
+    bool is_enabled();
+
+    // Whether a stimulus on the channel may be sent now; a token is then taken.
+    // A stimulus may not overtake the stimuli waiting on its channel.
+    bool try_send(const std::string& channel, long now);
+
+    // Let the stimulus wait until a token is available; then send is called.
+    // Returns false if the queue is full.
+    bool enqueue(const std::string& channel, std::function<void()> send);
+
+    // Drop all waiting stimuli, e.g. on a reset. Returns their number.
+    size_t clear();
+
+    void dump_statistics();
+
+private:
+    struct Channel {
+        Channel(double rate, double burst, long now);
+
+        TokenBucket                         bucket;
+        std::deque<std::function<void()> >  waiting;
+    };
+
+    Channel& get_channel(const std::string& channel, long now);
+    void     schedule_release(long now);
+    void     release();
+
+    boost::asio::io_service*   io_service_ptr;
+    AdapterCore*               adapter_core_ptr;
+    boost::asio::steady_timer  timer;
+    bool                       timer_armed;
+
+    double                     rate;         // per second, 0: disabled
+    double                     burst;
+    size_t                     queue_limit;
+    size_t                     n_waiting;
+
+    std::unordered_map<std::string, Channel>  channels;
+
+    unsigned long              n_paced;      // stimuli which had to wait
+    unsigned long              n_rejected;   // ... while the queue was full
+    unsigned long              n_dropped;
+    size_t                     max_waiting;
+};
+
+#endif // STIMULUS_PACER_HPP
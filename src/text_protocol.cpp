@@ -0,0 +1,694 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "spdlog/spdlog.h"
+#include "spdlog/fmt/fmt.h"
+
+#include "axini_protobuf.hpp"
+#include "configuration_snapshot.hpp"
+#include "text_protocol.hpp"
+
+static const char* WHITESPACE = " \t\r";
+
+static std::string trim(const std::string& s) {
+    size_t begin = s.find_first_not_of(WHITESPACE);
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(WHITESPACE);
+    return s.substr(begin, end - begin + 1);
+}
+
+// Splits off the first word of the text; the text is left with the rest.
+static std::string next_word(std::string* text_ptr) {
+    std::string text = trim(*text_ptr);
+    size_t end = text.find_first_of(WHITESPACE);
+    std::string word = text.substr(0, end);
+    *text_ptr = (end == std::string::npos) ? "" : trim(text.substr(end));
+    return word;
+}
+
+TextProtocol::TextProtocol()
+    : n_classes(1),
+      reset_defined(false),
+      matched_response(-1) {
+    std::memset(char_classes, 0, sizeof(char_classes));
+    TrieNode root;
+    root.response = -1;
+    trie.push_back(root);
+}
+
+bool TextProtocol::load(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file) {
+        spdlog::error("TextProtocol: cannot open " + filename);
+        return false;
+    }
+    std::stringstream spec;
+    spec << file.rdbuf();
+    return parse(spec.str(), filename);
+}
+
+bool TextProtocol::parse(const std::string& spec, const std::string& source) {
+    std::istringstream lines(spec);
+    std::string line;
+    int line_number = 0;
+    while (std::getline(lines, line)) {
+        line_number++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (!parse_line(line, source + ":" + std::to_string(line_number))) {
+            return false;
+        }
+    }
+    if (labels.empty()) {
+        spdlog::error("TextProtocol: " + source + " does not define any labels");
+        return false;
+    }
+    build_transitions();
+    build_exact_table();
+    return true;
+}
+
+bool TextProtocol::parse_line(const std::string& line, const std::string& location) {
+    std::string rest = line;
+    std::string kind = next_word(&rest);
+
+    if (kind == "channel") {
+        channel = next_word(&rest);
+        return true;
+    }
+
+    if (kind == "reset") {
+        reset_defined = parse_pattern(rest, &reset_pattern, location);
+        // The parameters are configuration items: their keys are interned
+        // before AMP sends a configuration (see configuration_snapshot.hpp).
+        reset_keys.clear();
+        for (size_t i = 0; i < reset_pattern.segments.size(); i++) {
+            if (reset_pattern.segments[i].is_parameter) {
+                reset_keys.push_back(ConfigurationKey(reset_pattern.segments[i].text));
+            }
+        }
+        return reset_defined;
+    }
+
+    if (kind == "reset_performed") {
+        reset_performed = rest;
+        return true;
+    }
+
+    if (kind != "stimulus" && kind != "response") {
+        spdlog::error("TextProtocol: " + location + ": unknown kind '" + kind + "'");
+        return false;
+    }
+
+    std::string name = next_word(&rest);
+    Pattern pattern;
+    if (name.empty() || !parse_pattern(rest, &pattern, location)) {
+        spdlog::error("TextProtocol: " + location + ": expected " + kind + " <name> <pattern>");
+        return false;
+    }
+
+    if (kind == "stimulus") {
+        labels.push_back(make_label(name, Label::STIMULUS, pattern));
+        stimulus_index[name] = stimulus_patterns.size();
+        stimulus_patterns.push_back(pattern);
+        return true;
+    }
+
+    int response = response_patterns.size();
+    labels.push_back(make_label(name, Label::RESPONSE, pattern));
+    response_labels.push_back(labels.back());
+    response_patterns.push_back(pattern);
+    if (!compile(pattern, response)) {
+        spdlog::error("TextProtocol: " + location + ": duplicate pattern for " + name);
+        return false;
+    }
+    return true;
+}
+
+// Splits the pattern into literal text and {name:type} parameters.
+bool TextProtocol::parse_pattern(const std::string& text, Pattern* pattern_ptr,
+                                 const std::string& location) {
+    pattern_ptr->segments.clear();
+    pattern_ptr->n_parameters = 0;
+    size_t position = 0;
+    while (position < text.size()) {
+        Segment segment;
+        size_t open = text.find('{', position);
+        if (open != position) {
+            segment.is_parameter = false;
+            segment.text = text.substr(position, open - position);
+            segment.type = STRING_PARAMETER;
+            pattern_ptr->segments.push_back(segment);
+            position = (open == std::string::npos) ? text.size() : open;
+            continue;
+        }
+
+        size_t close = text.find('}', open);
+        size_t colon = text.find(':', open);
+        if (close == std::string::npos || colon == std::string::npos || colon > close) {
+            spdlog::error("TextProtocol: " + location + ": expected {name:type} in " + text);
+            return false;
+        }
+        std::string type = text.substr(colon + 1, close - colon - 1);
+        segment.is_parameter = true;
+        segment.text = text.substr(open + 1, colon - open - 1);
+        if (type == "int") {
+            segment.type = INT_PARAMETER;
+        } else if (type == "decimal") {
+            segment.type = DECIMAL_PARAMETER;
+        } else if (type == "bool") {
+            segment.type = BOOL_PARAMETER;
+        } else if (type == "string") {
+            segment.type = STRING_PARAMETER;
+        } else {
+            spdlog::error("TextProtocol: " + location + ": unknown parameter type " + type);
+            return false;
+        }
+        if (!pattern_ptr->segments.empty() && pattern_ptr->segments.back().is_parameter) {
+            spdlog::error("TextProtocol: " + location + ": adjacent parameters in " + text);
+            return false;
+        }
+        if (++pattern_ptr->n_parameters > MAX_PARAMETERS) {
+            spdlog::error("TextProtocol: " + location + ": too many parameters in " + text);
+            return false;
+        }
+        pattern_ptr->segments.push_back(segment);
+        position = close + 1;
+    }
+    return !pattern_ptr->segments.empty();
+}
+
+// The parameters of the label carry a dummy value of their type.
+Label TextProtocol::make_label(const std::string& name, Label::LabelType type,
+                               const Pattern& pattern) {
+    std::vector<Label_Parameter> parameters;
+    std::vector<Segment>::const_iterator it;
+    for (it = pattern.segments.begin(); it != pattern.segments.end(); ++it) {
+        if (!it->is_parameter) {
+            continue;
+        }
+        Label_Parameter_Value value;
+        switch (it->type) {
+        case INT_PARAMETER:     value = axini::parameter_value(0); break;
+        case DECIMAL_PARAMETER: value = axini::parameter_value(0.0); break;
+        case BOOL_PARAMETER:    value = axini::parameter_value(false); break;
+        case STRING_PARAMETER:  value = axini::parameter_value(std::string("")); break;
+        }
+        parameters.push_back(axini::parameter(it->text, value));
+    }
+    return (type == Label::STIMULUS) ? axini::stimulus(name, channel, parameters)
+                                     : axini::response(name, channel, parameters);
+}
+
+const std::vector<Label>& TextProtocol::get_labels() {
+    return labels;
+}
+
+const std::string& TextProtocol::get_channel() {
+    return channel;
+}
+
+// ----- encoding
+
+void TextProtocol::append_value(const Label_Parameter_Value& value, std::string* buffer_ptr) {
+    char number[32];
+    fmt::format_to_n_result<char*> result;
+    switch (value.type_case()) {
+    case Label_Parameter_Value::kInteger:
+        result = fmt::format_to_n(number, sizeof(number), "{}", value.integer());
+        buffer_ptr->append(number, result.out - number);
+        break;
+    case Label_Parameter_Value::kDecimal:
+        result = fmt::format_to_n(number, sizeof(number), "{}", value.decimal());
+        buffer_ptr->append(number, result.out - number);
+        break;
+    case Label_Parameter_Value::kBoolean:
+        buffer_ptr->append(value.boolean() ? "true" : "false");
+        break;
+    case Label_Parameter_Value::kString:
+        buffer_ptr->append(value.string());
+        break;
+    default:
+        break;
+    }
+}
+
+// The parameters are looked up by name, so their order in the label does
+// not matter.
+bool TextProtocol::encode(const Label& stimulus, std::string* buffer_ptr) {
+    std::unordered_map<std::string, int>::const_iterator it =
+        stimulus_index.find(stimulus.label());
+    if (it == stimulus_index.end()) {
+        return false;
+    }
+
+    const Pattern& pattern = stimulus_patterns[it->second];
+    buffer_ptr->clear();
+    for (size_t i = 0; i < pattern.segments.size(); i++) {
+        const Segment& segment = pattern.segments[i];
+        if (!segment.is_parameter) {
+            buffer_ptr->append(segment.text);
+            continue;
+        }
+        for (int p = 0; p < stimulus.parameters_size(); p++) {
+            if (stimulus.parameters(p).name() == segment.text) {
+                append_value(stimulus.parameters(p).value(), buffer_ptr);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+bool TextProtocol::has_reset() {
+    return reset_defined;
+}
+
+void TextProtocol::encode_reset(const ConfigurationSnapshot& configuration,
+                                std::string* buffer_ptr) {
+    buffer_ptr->clear();
+    size_t parameter = 0;
+    for (size_t i = 0; i < reset_pattern.segments.size(); i++) {
+        const Segment& segment = reset_pattern.segments[i];
+        if (!segment.is_parameter) {
+            buffer_ptr->append(segment.text);
+            continue;
+        }
+        const ConfigurationKey& key = reset_keys[parameter++];
+        Label_Parameter_Value value;
+        switch (segment.type) {
+        case INT_PARAMETER:     value.set_integer(configuration.get_integer(key)); break;
+        case DECIMAL_PARAMETER: value.set_decimal(configuration.get_float(key)); break;
+        case BOOL_PARAMETER:    value.set_boolean(configuration.get_boolean(key)); break;
+        case STRING_PARAMETER:  value.set_string(configuration.get_string(key)); break;
+        }
+        append_value(value, buffer_ptr);
+    }
+}
+
+bool TextProtocol::is_reset_performed(const std::string& message) {
+    return !reset_performed.empty() && message == reset_performed;
+}
+
+// ----- decoding
+
+// Every character used in a pattern gets a class; all other characters share
+// class 0, which has no transitions.
+void TextProtocol::build_transitions() {
+    for (size_t node = 0; node < trie.size(); node++) {
+        for (size_t e = 0; e < trie[node].edges.size(); e++) {
+            unsigned char c = trie[node].edges[e].first;
+            if (char_classes[c] == 0) {
+                char_classes[c] = n_classes++;
+            }
+        }
+    }
+
+    transitions.assign(trie.size() * n_classes, -1);
+    for (size_t node = 0; node < trie.size(); node++) {
+        for (size_t e = 0; e < trie[node].edges.size(); e++) {
+            unsigned char c = trie[node].edges[e].first;
+            transitions[node * n_classes + char_classes[c]] = trie[node].edges[e].second;
+        }
+    }
+
+    runs.clear();
+    run_chars.clear();
+    for (size_t node = 0; node < trie.size(); node++) {
+        Run run;
+        run.offset = run_chars.size();
+        run.length = 0;
+        run.end = node;
+        run.has_parameters = !trie[node].parameter_edges.empty();
+        run.response = trie[node].response;
+        while (run.length < 0xffff && trie[run.end].edges.size() == 1 &&
+               trie[run.end].parameter_edges.empty() &&
+               (run.length == 0 || trie[run.end].response < 0)) {
+            run_chars.push_back(trie[run.end].edges[0].first);
+            run.end = trie[run.end].edges[0].second;
+            run.length++;
+        }
+        runs.push_back(run);
+    }
+}
+
+// Mixes the length and the first and last (up to) eight characters of the
+// message, which are loaded as words: no call to memcpy for a short message.
+static inline size_t exact_hash(const char* message, size_t length) {
+    uint64_t hash;
+    if (length >= 8) {
+        uint64_t head;
+        uint64_t tail;
+        std::memcpy(&head, message, 8);
+        std::memcpy(&tail, message + length - 8, 8);
+        hash = head ^ (tail * 0xc2b2ae3d27d4eb4fULL);
+    } else if (length >= 4) {
+        uint32_t head;
+        uint32_t tail;
+        std::memcpy(&head, message, 4);
+        std::memcpy(&tail, message + length - 4, 4);
+        hash = head | ((uint64_t) tail << 32);
+    } else {
+        hash = 0;
+        for (size_t i = 0; i < length; i++) {
+            hash = (hash << 8) | (unsigned char) message[i];
+        }
+    }
+    hash ^= length * 0x9e3779b97f4a7c15ULL;
+    hash *= 0x9e3779b97f4a7c15ULL;
+    return (size_t) (hash >> 32);
+}
+
+// A table of at least twice the number of patterns keeps the probe
+// sequences short; the patterns are only compared on a hash match.
+void TextProtocol::build_exact_table() {
+    size_t n_exact = 0;
+    for (size_t r = 0; r < response_patterns.size(); r++) {
+        n_exact += (response_patterns[r].n_parameters == 0);
+    }
+    size_t size = 4;
+    while (size < 2 * n_exact) {
+        size *= 2;
+    }
+
+    ExactEntry empty;
+    empty.offset = 0;
+    empty.length = 0;
+    empty.response = -1;
+    exact_table.assign(size, empty);
+    exact_chars.clear();
+    for (size_t r = 0; r < response_patterns.size(); r++) {
+        const Pattern& pattern = response_patterns[r];
+        if (pattern.n_parameters != 0) {
+            continue;
+        }
+        ExactEntry entry;
+        entry.offset = exact_chars.size();
+        entry.length = 0;
+        entry.response = r;
+        for (size_t i = 0; i < pattern.segments.size(); i++) {
+            exact_chars.append(pattern.segments[i].text);
+            entry.length += pattern.segments[i].text.size();
+        }
+        size_t slot = exact_hash(exact_chars.data() + entry.offset, entry.length) & (size - 1);
+        while (exact_table[slot].response >= 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        exact_table[slot] = entry;
+    }
+}
+
+int TextProtocol::transition(int node, char c) {
+    return transitions[node * n_classes + char_classes[(unsigned char) c]];
+}
+
+int TextProtocol::child(int node, char c) {
+    const std::vector<std::pair<char, int> >& edges = trie[node].edges;
+    for (size_t i = 0; i < edges.size(); i++) {
+        if (edges[i].first == c) {
+            return edges[i].second;
+        }
+    }
+    return -1;
+}
+
+// Adds the pattern to the trie. Returns false for a duplicate pattern.
+bool TextProtocol::compile(const Pattern& pattern, int response) {
+    int node = 0;
+    for (size_t i = 0; i < pattern.segments.size(); i++) {
+        const Segment& segment = pattern.segments[i];
+        if (!segment.is_parameter) {
+            for (size_t c = 0; c < segment.text.size(); c++) {
+                int next = child(node, segment.text[c]);
+                if (next < 0) {
+                    next = trie.size();
+                    TrieNode new_node;
+                    new_node.response = -1;
+                    trie.push_back(new_node);
+                    trie[node].edges.push_back(std::make_pair(segment.text[c], next));
+                }
+                node = next;
+            }
+            continue;
+        }
+
+        char terminator = (i + 1 < pattern.segments.size()) ?
+            pattern.segments[i + 1].text[0] : 0;
+        int next = -1;
+        std::vector<ParameterEdge>& parameter_edges = trie[node].parameter_edges;
+        for (size_t e = 0; e < parameter_edges.size(); e++) {
+            if (parameter_edges[e].type == segment.type &&
+                    parameter_edges[e].terminator == terminator) {
+                next = parameter_edges[e].next;
+            }
+        }
+        if (next < 0) {
+            next = trie.size();
+            ParameterEdge edge;
+            edge.type = segment.type;
+            edge.terminator = terminator;
+            edge.next = next;
+            trie[node].parameter_edges.push_back(edge);
+            TrieNode new_node;
+            new_node.response = -1;
+            trie.push_back(new_node);
+        }
+        node = next;
+    }
+
+    if (trie[node].response >= 0) {
+        return false;
+    }
+    trie[node].response = response;
+    return true;
+}
+
+template <typename T>
+static bool equal_word(const char* a, const char* b) {
+    T x;
+    T y;
+    std::memcpy(&x, a, sizeof(T));
+    std::memcpy(&y, b, sizeof(T));
+    return x == y;
+}
+
+// The runs are short: comparing them inline, a word at a time (the last word
+// overlapping the previous one), is faster than calling memcmp.
+static bool equal(const char* a, const char* b, size_t length) {
+    if (length >= 8) {
+        for (; length > 8; a += 8, b += 8, length -= 8) {
+            if (!equal_word<uint64_t>(a, b)) {
+                return false;
+            }
+        }
+        return equal_word<uint64_t>(a + length - 8, b + length - 8);
+    }
+    if (length >= 4) {
+        return equal_word<uint32_t>(a, b) &&
+            equal_word<uint32_t>(a + length - 4, b + length - 4);
+    }
+    for (; length > 0; length--) {
+        if (*a++ != *b++) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_digit(const char* p, const char* end) {
+    return p < end && *p >= '0' && *p <= '9';
+}
+
+// Whether the digits from p to end are a number of at most LONG_MAX.
+static bool fits_long(const char* p, const char* end) {
+    unsigned long value = 0;
+    for (; p < end; p++) {
+        unsigned long digit = *p - '0';
+        if (value > (LONG_MAX - digit) / 10) {
+            return false;
+        }
+        value = value * 10 + digit;
+    }
+    return true;
+}
+
+// Returns the end of the parameter of the edge starting at p, or 0 if there
+// is no such parameter. An integer which does not fit in a long is not one.
+const char* TextProtocol::scan(const ParameterEdge& edge, const char* p, const char* end) {
+    const char* q = p;
+    const char* digits;
+    switch (edge.type) {
+    case INT_PARAMETER:
+    case DECIMAL_PARAMETER:
+        if (q < end && *q == '-') {
+            q++;
+        }
+        if (!is_digit(q, end)) {
+            return 0;
+        }
+        digits = q;
+        while (is_digit(q, end)) {
+            q++;
+        }
+        if (edge.type == INT_PARAMETER && !fits_long(digits, q)) {
+            return 0;
+        }
+        if (edge.type == DECIMAL_PARAMETER && q < end && *q == '.' && is_digit(q + 1, end)) {
+            q++;
+            while (is_digit(q, end)) {
+                q++;
+            }
+        }
+        return q;
+    case BOOL_PARAMETER:
+        if (end - p >= 4 && std::memcmp(p, "true", 4) == 0) {
+            return p + 4;
+        }
+        if (end - p >= 5 && std::memcmp(p, "false", 5) == 0) {
+            return p + 5;
+        }
+        return 0;
+    default:
+        while (q < end && (edge.terminator == 0 || *q != edge.terminator)) {
+            q++;
+        }
+        return q;
+    }
+}
+
+// Literal edges are tried before parameter edges. As long as there are no
+// parameter edges, there is nothing to backtrack to.
+bool TextProtocol::match(int node, const char* p, const char* end, int depth) {
+    while (p < end && !runs[node].has_parameters) {
+        const Run& run = runs[node];
+        if (run.length > 0) {
+            if ((size_t) (end - p) < run.length ||
+                    !equal(p, run_chars.data() + run.offset, run.length)) {
+                return false;
+            }
+            p += run.length;
+            node = run.end;
+            continue;
+        }
+        node = transition(node, *p);
+        if (node < 0) {
+            return false;
+        }
+        p++;
+    }
+
+    if (p == end && runs[node].response >= 0) {
+        matched_response = runs[node].response;
+        return true;
+    }
+
+    if (p < end) {
+        int next = transition(node, *p);
+        if (next >= 0 && match(next, p + 1, end, depth)) {
+            return true;
+        }
+    }
+
+    const std::vector<ParameterEdge>& parameter_edges = trie[node].parameter_edges;
+    for (size_t e = 0; e < parameter_edges.size(); e++) {
+        const ParameterEdge& edge = parameter_edges[e];
+        const char* q = scan(edge, p, end);
+        if (q != 0) {
+            captures[depth].begin = p;
+            captures[depth].end = q;
+            if (match(edge.next, q, end, depth + 1)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// The parameters are updated in place; a string keeps its capacity.
+void TextProtocol::fill(Label* label_ptr, const Pattern& pattern) {
+    int parameter = 0;
+    for (size_t i = 0; i < pattern.segments.size(); i++) {
+        const Segment& segment = pattern.segments[i];
+        if (!segment.is_parameter) {
+            continue;
+        }
+        const Capture& capture = captures[parameter];
+        Label_Parameter_Value* value_ptr =
+            label_ptr->mutable_parameters(parameter)->mutable_value();
+        switch (segment.type) {
+        case INT_PARAMETER: {
+            // The capture fits in a long, see scan.
+            const char* p = capture.begin;
+            bool negative = *p == '-';
+            long integer = 0;
+            for (p += negative ? 1 : 0; p < capture.end; p++) {
+                integer = integer * 10 + (*p - '0');
+            }
+            value_ptr->set_integer(negative ? -integer : integer);
+            break;
+        }
+        case DECIMAL_PARAMETER: {
+            char number[64];
+            size_t length = capture.end - capture.begin;
+            length = (length < sizeof(number) - 1) ? length : sizeof(number) - 1;
+            std::memcpy(number, capture.begin, length);
+            number[length] = 0;
+            value_ptr->set_decimal(std::strtod(number, 0));
+            break;
+        }
+        case BOOL_PARAMETER:
+            value_ptr->set_boolean(*capture.begin == 't');
+            break;
+        case STRING_PARAMETER:
+            value_ptr->mutable_string()->assign(capture.begin, capture.end - capture.begin);
+            break;
+        }
+        parameter++;
+    }
+}
+
+// Returns the response of the pattern without parameters which equals the
+// message, or -1.
+inline int TextProtocol::find_exact(const char* message, size_t length) {
+    size_t mask = exact_table.size() - 1;
+    size_t slot = exact_hash(message, length) & mask;
+    for (;;) {
+        const ExactEntry& entry = exact_table[slot];
+        if (entry.response < 0) {
+            return -1;
+        }
+        if (entry.length == length &&
+                equal(message, exact_chars.data() + entry.offset, length)) {
+            return entry.response;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+// A literal path in the trie takes precedence over parameters, so a message
+// which equals a pattern without parameters decodes to that pattern either
+// way.
+const Label* TextProtocol::decode(const char* message, size_t length) {
+    if (!exact_table.empty()) {
+        int response = find_exact(message, length);
+        if (response >= 0) {
+            return &response_labels[response];
+        }
+    }
+    if (transitions.empty() || !match(0, message, message + length, 0)) {
+        return 0;
+    }
+    Label* label_ptr = &response_labels[matched_response];
+    fill(label_ptr, response_patterns[matched_response]);
+    return label_ptr;
+}
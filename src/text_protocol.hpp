@@ -0,0 +1,163 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef TEXT_PROTOCOL_HPP
+#define TEXT_PROTOCOL_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "configuration_snapshot.hpp"
+#include "pa_protobuf.hpp"
+using namespace PluginAdapter::Api;
+
+// A TextProtocol describes a line-oriented SUT protocol: the labels, their
+// channels and parameters, and the wire pattern of every label. It is read
+// from a spec file, e.g.:
+//
+//     # The standalone SmartDoor SUT.
+//     channel door
+//     stimulus open             OPEN
+//     stimulus lock             LOCK:{passcode:int}
+//     response opened           OPENED
+//     response invalid_command  INVALID_COMMAND
+//     reset                     RESET:{manufacturer:string}
+//     reset_performed           RESET_PERFORMED
+//
+// A pattern consists of literal text and parameters {name:type}, with the
+// types int, decimal, bool and string. Two parameters may not be adjacent.
+// A string parameter extends up to the first character of the literal text
+// that follows it (or to the end of the message). The parameters of the
+// reset message are taken from the configuration items with the same names.
+//
+// The response patterns without parameters are also kept in an exact-match
+// hash table, which is looked up first: most responses are fixed strings,
+// which are then decoded with a single probe and compare.
+//
+// The response patterns are compiled into a trie, whose literal edges form a
+// DFA transition table over the characters used in the patterns; chains of
+// nodes without alternatives are compared a word at a time. Parsing a SUT
+// message walks the trie (backtracking only at the nodes where a parameter
+// starts) and updates the parameters of a prebuilt response Label
+// in place: no regular expressions and, once the labels have been used, no
+// allocations.
+class TextProtocol {
+public:
+    TextProtocol();
+
+    // Returns false (after logging the error) if the spec is not valid.
+    bool load(const std::string& filename);
+    bool parse(const std::string& spec, const std::string& source = "spec");
+
+    // All labels of the protocol, for the announcement.
+    const std::vector<Label>& get_labels();
+    const std::string& get_channel();
+
+    // Write the wire message of a stimulus into the buffer. Returns false if
+    // the stimulus is not part of the protocol.
+    bool encode(const Label& stimulus, std::string* buffer_ptr);
+
+    // The response label of a wire message, or 0 if it does not match any
+    // response pattern. The label is owned by the TextProtocol and is valid
+    // until the next call.
+    const Label* decode(const char* message, size_t length);
+
+    bool has_reset();
+    void encode_reset(const ConfigurationSnapshot& configuration, std::string* buffer_ptr);
+    bool is_reset_performed(const std::string& message);
+
+private:
+    enum ParameterType { INT_PARAMETER, DECIMAL_PARAMETER, BOOL_PARAMETER, STRING_PARAMETER };
+
+    struct Segment {
+        bool           is_parameter;
+        std::string    text;           // literal text, or the parameter name
+        ParameterType  type;
+    };
+
+    struct Pattern {
+        std::vector<Segment>  segments;
+        int                   n_parameters;
+    };
+
+    struct ParameterEdge {
+        ParameterType  type;
+        char           terminator;     // 0: up to the end of the message
+        int            next;
+    };
+
+    struct TrieNode {
+        std::vector<std::pair<char, int> >  edges;
+        std::vector<ParameterEdge>          parameter_edges;
+        int                                 response;  // -1: not accepting
+    };
+
+    // The decoding data of a node: the chain of nodes with a single literal
+    // edge starting at the node, and the node itself.
+    struct Run {
+        unsigned        offset;        // into run_chars
+        unsigned short  length;        // 0: the node has alternatives
+        bool            has_parameters;
+        int             end;
+        int             response;
+    };
+
+    // A response pattern without parameters in the exact-match table.
+    struct ExactEntry {
+        unsigned  offset;              // into exact_chars
+        unsigned  length;
+        int       response;            // -1: empty slot
+    };
+
+    // The begin and end of a parameter in the message being decoded.
+    struct Capture {
+        const char*  begin;
+        const char*  end;
+    };
+
+    static const int MAX_PARAMETERS = 16;
+
+    bool parse_line(const std::string& line, const std::string& location);
+    bool parse_pattern(const std::string& text, Pattern* pattern_ptr,
+                       const std::string& location);
+    Label make_label(const std::string& name, Label::LabelType type, const Pattern& pattern);
+
+    bool compile(const Pattern& pattern, int response);
+    void build_transitions();
+    void build_exact_table();
+    int  find_exact(const char* message, size_t length);
+    int  child(int node, char c);
+    int  transition(int node, char c);
+    static const char* scan(const ParameterEdge& edge, const char* p, const char* end);
+    bool match(int node, const char* p, const char* end, int depth);
+    void fill(Label* label_ptr, const Pattern& pattern);
+
+    void append_value(const Label_Parameter_Value& value, std::string* buffer_ptr);
+
+    std::string                           channel;
+    std::vector<Label>                    labels;
+
+    std::unordered_map<std::string, int>  stimulus_index;
+    std::vector<Pattern>                  stimulus_patterns;
+
+    std::vector<Pattern>                  response_patterns;
+    std::vector<Label>                    response_labels;
+    std::vector<TrieNode>                 trie;
+    std::vector<int>                      transitions;  // [node * n_classes + class]
+    unsigned char                         char_classes[256];
+    int                                   n_classes;
+    std::vector<Run>                      runs;         // [node]
+    std::string                           run_chars;
+    std::vector<ExactEntry>               exact_table;  // size: a power of 2
+    std::string                           exact_chars;
+
+    Pattern                               reset_pattern;
+    std::vector<ConfigurationKey>         reset_keys;   // of its parameters
+    bool                                  reset_defined;
+    std::string                           reset_performed;
+
+    Capture                               captures[MAX_PARAMETERS];
+    int                                   matched_response;
+};
+
+#endif // TEXT_PROTOCOL_HPP
@@ -0,0 +1,58 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include "spdlog/spdlog.h"
+
+#include "axini_protobuf.hpp"
+#include "text_protocol_handler.hpp"
+
+// We use boost for to_lower and to_upper.
+#include <boost/algorithm/string.hpp>
+
+TextProtocolHandler::TextProtocolHandler(const std::string& spec_filename, std::string sut_url,
+                                         boost::asio::io_service* io_service_ptr)
+    : SmartDoorHandler(sut_url, io_service_ptr) {
+    loaded = protocol.load(spec_filename);
+    if (loaded) {
+        spdlog::info("TextProtocolHandler: loaded " + std::to_string(protocol.get_labels().size()) +
+                     " labels from " + spec_filename);
+    }
+}
+
+bool TextProtocolHandler::is_loaded() {
+    return loaded;
+}
+
+std::vector<Label> TextProtocolHandler::get_supported_labels() {
+    return protocol.get_labels();
+}
+
+// Unknown responses are passed on to AMP, like the SmartDoorHandler does.
+const Label& TextProtocolHandler::sut_message_to_label(const std::string& message) {
+    const Label* label_ptr = protocol.decode(message.data(), message.size());
+    if (label_ptr != 0) {
+        return *label_ptr;
+    }
+    unknown_response = axini::response(boost::to_lower_copy(message), protocol.get_channel());
+    return unknown_response;
+}
+
+// Stimuli which are not part of the protocol are sent as bad weather.
+const std::string& TextProtocolHandler::label_to_sut_message(const Label& stimulus) {
+    if (!protocol.encode(stimulus, &sut_message)) {
+        sut_message = boost::to_upper_copy(stimulus.label());
+    }
+    return sut_message;
+}
+
+const std::string& TextProtocolHandler::reset_to_sut_message() {
+    if (!protocol.has_reset()) {
+        return SmartDoorHandler::reset_to_sut_message();
+    }
+    protocol.encode_reset(*get_snapshot(), &reset_message);
+    return reset_message;
+}
+
+bool TextProtocolHandler::is_reset_performed(const std::string& message) {
+    return protocol.has_reset() ? protocol.is_reset_performed(message)
+                                : SmartDoorHandler::is_reset_performed(message);
+}
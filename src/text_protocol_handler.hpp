@@ -0,0 +1,42 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef TEXT_PROTOCOL_HANDLER_HPP
+#define TEXT_PROTOCOL_HANDLER_HPP
+
+#include <string>
+#include <vector>
+
+#include "smartdoor_handler.hpp"
+#include "text_protocol.hpp"
+
+// The TextProtocolHandler is a Handler for line-oriented WebSocket SUTs like
+// the SmartDoor, whose labels and wire format are read from a spec file (see
+// text_protocol.hpp) instead of being hardcoded. The connection, the resets
+// and the configuration are those of the SmartDoorHandler. If the spec does
+// not define a reset, the SmartDoor reset (RESET:<manufacturer>) is used.
+
+class TextProtocolHandler: public SmartDoorHandler {
+public:
+    TextProtocolHandler(const std::string& spec_filename, std::string sut_url,
+                        boost::asio::io_service* io_service_ptr = 0);
+
+    // Whether the spec has been loaded; the handler is useless otherwise.
+    bool is_loaded();
+
+    std::vector<Label> get_supported_labels();
+
+protected:
+    const Label&       sut_message_to_label(const std::string& message);
+    const std::string& label_to_sut_message(const Label& stimulus);
+    const std::string& reset_to_sut_message();
+    bool               is_reset_performed(const std::string& message);
+
+private:
+    TextProtocol  protocol;
+    bool          loaded;
+    std::string   sut_message;
+    std::string   reset_message;
+    Label         unknown_response;
+};
+
+#endif // TEXT_PROTOCOL_HANDLER_HPP
@@ -0,0 +1,144 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <cstdio>
+
+#include "spdlog/spdlog.h"
+
+#include "tls_client_context.hpp"
+#include "latency_histogram.hpp"
+#include "env.hpp"
+
+// The new session callback is only called with client caching enabled. The
+// sessions are kept by the TlsClientContext, not in OpenSSL's internal cache.
+TlsClientContext::TlsClientContext()
+    : context(std::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::sslv23)),
+      session(0),
+      measuring(false),
+      handshake_start(0),
+      last_handshake_time(0),
+      last_resumed(false),
+      n_full(0),
+      full_time(0),
+      n_resumed(0),
+      resumed_time(0) {
+    resume = axini::env_long("ADAPTER_TLS_RESUME", 1) != 0;
+
+    context->set_default_verify_paths();
+
+    SSL_CTX* ctx = context->native_handle();
+    SSL_CTX_set_app_data(ctx, this);
+    SSL_CTX_set_info_callback(ctx, &TlsClientContext::on_info);
+    if (resume) {
+        SSL_CTX_set_session_cache_mode(ctx,
+            SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, &TlsClientContext::on_new_session);
+    }
+}
+
+TlsClientContext::~TlsClientContext() {
+    SSL_CTX_set_app_data(context->native_handle(), 0);
+    if (session != 0) {
+        SSL_SESSION_free(session);
+    }
+}
+
+std::shared_ptr<boost::asio::ssl::context> TlsClientContext::get_context() {
+    return context;
+}
+
+void TlsClientContext::prepare(SSL* ssl) {
+    std::lock_guard<std::mutex> lock(mutex);
+    measuring = true;
+    handshake_start = 0;
+    if (session == 0) {
+        return;
+    }
+    // A resumed session stays the session of the connection: it is handed
+    // over as a copy, which OpenSSL may mark as not resumable.
+    SSL_SESSION* copy = SSL_SESSION_dup(session);
+    if (copy != 0) {
+        SSL_set_session(ssl, copy);
+        SSL_SESSION_free(copy);
+    }
+}
+
+// Called during the handshake (TLS 1.2) or when a ticket arrives after it
+// (TLS 1.3). A copy of the session is kept: OpenSSL marks the session of a
+// connection which is not shut down cleanly as not resumable, while TLS 1.1
+// and later allow to resume it, e.g. after AMP dropped the connection.
+int TlsClientContext::on_new_session(SSL* ssl, SSL_SESSION* session) {
+    TlsClientContext* self = (TlsClientContext*) SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    if (self == 0) {
+        return 0;
+    }
+
+    SSL_SESSION* copy = SSL_SESSION_dup(session);
+    if (copy == 0) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(self->mutex);
+    if (self->session != 0) {
+        SSL_SESSION_free(self->session);
+    }
+    self->session = copy;
+    return 0;
+}
+
+// With TLS 1.3, OpenSSL also reports a handshake for a ticket that arrives
+// after the handshake: only the first handshake of a connection is measured.
+void TlsClientContext::on_info(const SSL* ssl, int where, int ret) {
+    if ((where & (SSL_CB_HANDSHAKE_START | SSL_CB_HANDSHAKE_DONE)) == 0) {
+        return;
+    }
+    TlsClientContext* self = (TlsClientContext*) SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    if (self == 0) {
+        return;
+    }
+
+    long now = LatencyRecorder::now();
+    std::lock_guard<std::mutex> lock(self->mutex);
+    if (!self->measuring) {
+        return;
+    }
+    if (where & SSL_CB_HANDSHAKE_START) {
+        if (self->handshake_start == 0) {
+            self->handshake_start = now;
+        }
+        return;
+    }
+    if (self->handshake_start == 0) {
+        return;
+    }
+
+    self->measuring = false;
+    self->last_handshake_time = now - self->handshake_start;
+    self->last_resumed = SSL_session_reused((SSL*) ssl) != 0;
+    if (self->last_resumed) {
+        self->n_resumed++;
+        self->resumed_time += self->last_handshake_time;
+    } else {
+        self->n_full++;
+        self->full_time += self->last_handshake_time;
+    }
+}
+
+long TlsClientContext::get_last_handshake_time() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return last_handshake_time;
+}
+
+bool TlsClientContext::was_last_handshake_resumed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return last_resumed;
+}
+
+void TlsClientContext::dump_statistics(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    char line[256];
+    snprintf(line, sizeof(line),
+        "%s: %lu full TLS handshakes (%.2f ms on average), %lu resumed (%.2f ms on average)",
+        name.c_str(),
+        n_full, (n_full > 0) ? full_time / 1e6 / n_full : 0.0,
+        n_resumed, (n_resumed > 0) ? resumed_time / 1e6 / n_resumed : 0.0);
+    spdlog::info(line);
+}
@@ -0,0 +1,58 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef TLS_CLIENT_CONTEXT_HPP
+#define TLS_CLIENT_CONTEXT_HPP
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/asio/ssl.hpp>
+
+// The TlsClientContext is the TLS context of the connection with AMP. It is
+// built once (loading the CA store once) and used for all connection
+// attempts. The TLS session of the last connection is kept, and resumed by
+// the next connection (with a TLS 1.2 session id or a TLS 1.3 ticket), which
+// saves a full handshake on a reconnect. Session resumption can be disabled
+// with ADAPTER_TLS_RESUME=0.
+//
+// The time of the handshakes is measured, separately for the full and the
+// resumed handshakes.
+class TlsClientContext {
+public:
+    TlsClientContext();
+    ~TlsClientContext();
+
+    std::shared_ptr<boost::asio::ssl::context> get_context();
+
+    // Call before the handshake of a new connection: offer the kept session.
+    void prepare(SSL* ssl);
+
+    // The duration of the last handshake in nanoseconds (0: none yet).
+    long get_last_handshake_time();
+    bool was_last_handshake_resumed();
+
+    void dump_statistics(const std::string& name);
+
+private:
+    static int  on_new_session(SSL* ssl, SSL_SESSION* session);
+    static void on_info(const SSL* ssl, int where, int ret);
+
+private:
+    std::shared_ptr<boost::asio::ssl::context>  context;
+    bool                                        resume;
+
+    std::mutex       mutex;
+    SSL_SESSION*     session;            // the session to resume, or 0
+    bool             measuring;          // a handshake of a prepared connection
+    long             handshake_start;
+    long             last_handshake_time;
+    bool             last_resumed;
+
+    unsigned long    n_full;
+    long             full_time;          // nanoseconds
+    unsigned long    n_resumed;
+    long             resumed_time;
+};
+
+#endif // TLS_CLIENT_CONTEXT_HPP
@@ -0,0 +1,79 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include <cstdio>
+
+#include "spdlog/spdlog.h"
+
+#include "water_marks.hpp"
+#include "env.hpp"
+
+static const long DEFAULT_HIGH_WATER_KB = 4096;
+
+WaterMarks::WaterMarks()
+    : high(false),
+      high_time(0),
+      n_high(0),
+      total_high_time(0),
+      max_buffered(0) {
+    long high_kb = axini::env_long("ADAPTER_HIGH_WATER_KB", DEFAULT_HIGH_WATER_KB);
+    long low_kb = axini::env_long("ADAPTER_LOW_WATER_KB", high_kb / 4);
+    high_water = (high_kb > 0) ? high_kb * 1024 : 0;
+    low_water = (low_kb > 0 && low_kb < high_kb) ? low_kb * 1024 : 0;
+}
+
+WaterMarks::WaterMarks(size_t high_water, size_t low_water)
+    : high_water(high_water),
+      low_water(low_water < high_water ? low_water : 0),
+      high(false),
+      high_time(0),
+      n_high(0),
+      total_high_time(0),
+      max_buffered(0) {
+}
+
+bool WaterMarks::is_enabled() {
+    return high_water > 0;
+}
+
+bool WaterMarks::is_high() {
+    return high;
+}
+
+WaterMarks::Crossing WaterMarks::update(size_t buffered, long now) {
+    if (buffered > max_buffered) {
+        max_buffered = buffered;
+    }
+    if (!is_enabled()) {
+        return NO_CROSSING;
+    }
+
+    if (!high && buffered >= high_water) {
+        high = true;
+        high_time = now;
+        n_high++;
+        return HIGH_CROSSING;
+    }
+    if (high && buffered <= low_water) {
+        high = false;
+        total_high_time += now - high_time;
+        return LOW_CROSSING;
+    }
+    return NO_CROSSING;
+}
+
+void WaterMarks::clear(long now) {
+    if (high) {
+        high = false;
+        total_high_time += now - high_time;
+    }
+}
+
+void WaterMarks::dump_statistics(const std::string& name) {
+    char line[256];
+    snprintf(line, sizeof(line),
+        "%s: max %lu bytes buffered, %lu times above the high water mark (%lu KB) "
+        "for %.1f ms in total",
+        name.c_str(), (unsigned long) max_buffered, n_high,
+        (unsigned long) high_water / 1024, total_high_time / 1e6);
+    spdlog::info(line);
+}
@@ -0,0 +1,47 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef WATER_MARKS_HPP
+#define WATER_MARKS_HPP
+
+#include <cstddef>
+#include <string>
+
+// WaterMarks bound the number of bytes which are buffered for a connection,
+// but not yet written to its socket. When the buffered amount rises to the
+// high water mark the connection is "high"; it stays high until the amount
+// has dropped to the low water mark. A high water mark of 0 disables the
+// marks.
+//
+// The marks are read from the environment variables ADAPTER_HIGH_WATER_KB
+// (default: 4096) and ADAPTER_LOW_WATER_KB (default: a quarter of the high
+// water mark).
+class WaterMarks {
+public:
+    enum Crossing { NO_CROSSING, HIGH_CROSSING, LOW_CROSSING };
+
+    WaterMarks();
+    WaterMarks(size_t high_water, size_t low_water);
+
+    bool is_enabled();
+    bool is_high();
+
+    // Returns the mark which the buffered amount has crossed, if any.
+    Crossing update(size_t buffered, long now);
+
+    // Forget the buffered amount, e.g. when the connection is closed.
+    void clear(long now);
+
+    void dump_statistics(const std::string& name);
+
+private:
+    size_t         high_water;     // bytes, 0: disabled
+    size_t         low_water;
+    bool           high;
+    long           high_time;      // when the last high crossing happened
+
+    unsigned long  n_high;         // high crossings
+    long           total_high_time;
+    size_t         max_buffered;
+};
+
+#endif // WATER_MARKS_HPP
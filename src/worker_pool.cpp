@@ -0,0 +1,165 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#include "spdlog/spdlog.h"
+#include "worker_pool.hpp"
+
+// ----- WorkQueue
+
+WorkQueue::WorkQueue(WorkerPool* pool_ptr)
+    : pool_ptr(pool_ptr),
+      head(&stub),
+      tail(&stub),
+      n_tasks(0) {
+    stub.next = 0;
+}
+
+WorkQueue::~WorkQueue() {
+    // A WorkQueue does not "own" the WorkerPool, so we should *not* delete it.
+    // It does "own" the nodes of the tasks that have not been run.
+    Node* node_ptr;
+    while ((node_ptr = pop()) != 0) {
+        delete node_ptr;
+    }
+}
+
+// Add a task to the queue. If the queue was idle, schedule it on the pool.
+void WorkQueue::post(std::function<void()> task) {
+    Node* node_ptr = new Node();
+    node_ptr->task = std::move(task);
+    push(node_ptr);
+
+    if (n_tasks.fetch_add(1, std::memory_order_acq_rel) == 0) {
+        pool_ptr->get_io_service().post(std::bind(&WorkQueue::drain, this));
+    }
+}
+
+// Producers link the node after the last pushed node. Between the exchange
+// and the store, the node is not yet reachable for the consumer.
+void WorkQueue::push(Node* node_ptr) {
+    node_ptr->next.store(0, std::memory_order_relaxed);
+    Node* previous_ptr = head.exchange(node_ptr, std::memory_order_acq_rel);
+    previous_ptr->next.store(node_ptr, std::memory_order_release);
+}
+
+// Returns 0 when the queue is empty, or when the next node has been pushed
+// but is not yet linked. The stub node is never returned: it is pushed
+// again when the last node is popped, so that the queue is never empty.
+WorkQueue::Node* WorkQueue::pop() {
+    Node* tail_ptr = tail;
+    Node* next_ptr = tail_ptr->next.load(std::memory_order_acquire);
+
+    if (tail_ptr == &stub) {
+        if (next_ptr == 0) {
+            return 0;
+        }
+        tail = next_ptr;
+        tail_ptr = next_ptr;
+        next_ptr = next_ptr->next.load(std::memory_order_acquire);
+    }
+
+    if (next_ptr != 0) {
+        tail = next_ptr;
+        return tail_ptr;
+    }
+
+    if (tail_ptr != head.load(std::memory_order_acquire)) {
+        return 0;
+    }
+
+    push(&stub);
+    next_ptr = tail_ptr->next.load(std::memory_order_acquire);
+    if (next_ptr != 0) {
+        tail = next_ptr;
+        return tail_ptr;
+    }
+    return 0;
+}
+
+// Run at most 'quantum' tasks. If there is still work left, the queue is
+// rescheduled at the back of the pool's run queue, after the other sessions.
+// When the last task has been run, the queue is idle and the next post()
+// schedules it again, so there is never more than one drain() at a time.
+void WorkQueue::drain() {
+    size_t quantum = pool_ptr->get_quantum();
+
+    for (size_t i = 0; i < quantum; i++) {
+        // n_tasks > 0, so a node has been pushed; it may not be linked yet.
+        Node* node_ptr;
+        while ((node_ptr = pop()) == 0) {
+            std::this_thread::yield();
+        }
+
+        node_ptr->task();
+        delete node_ptr;
+
+        if (n_tasks.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            return;
+        }
+    }
+
+    pool_ptr->get_io_service().post(std::bind(&WorkQueue::drain, this));
+}
+
+// ----- WorkerPool
+
+WorkerPool::WorkerPool(size_t n_threads, size_t quantum)
+    : work_ptr(0),
+      n_threads(n_threads > 0 ? n_threads : 1),
+      quantum(quantum > 0 ? quantum : 1) {
+}
+
+WorkerPool::~WorkerPool() {
+    stop();
+    join();
+
+    for (WorkQueue* queue_ptr : queues) {
+        delete queue_ptr;
+    }
+}
+
+// The WorkerPool "owns" the queues it creates.
+WorkQueue* WorkerPool::create_queue() {
+    std::lock_guard<std::mutex> lock(queues_mutex);
+    WorkQueue* queue_ptr = new WorkQueue(this);
+    queues.push_back(queue_ptr);
+    return queue_ptr;
+}
+
+// Start the worker threads. The pool keeps running, also when there is
+// no work, until stop() is called.
+void WorkerPool::run() {
+    spdlog::info("WorkerPool: starting " + std::to_string(n_threads) + " worker thread(s)");
+    work_ptr = new boost::asio::io_service::work(io_service);
+    for (size_t i = 0; i < n_threads; i++) {
+        threads.push_back(std::thread([this]() { io_service.run(); }));
+    }
+}
+
+void WorkerPool::stop() {
+    if (work_ptr != 0) {
+        delete work_ptr;
+        work_ptr = 0;
+    }
+    io_service.stop();
+}
+
+void WorkerPool::join() {
+    for (std::thread& thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    threads.clear();
+}
+
+size_t WorkerPool::get_thread_count() {
+    return n_threads;
+}
+
+size_t WorkerPool::get_quantum() {
+    return quantum;
+}
+
+boost::asio::io_service& WorkerPool::get_io_service() {
+    return io_service;
+}
@@ -0,0 +1,80 @@
+// Copyright 2023 Axini B.V. https://www.axini.com, see: LICENSE.txt.
+
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+
+class WorkerPool;
+
+// A WorkQueue serializes the tasks of a single adapter session. Tasks posted
+// on the same WorkQueue are executed in order and never concurrently.
+// Tasks of different WorkQueues may run in parallel on the WorkerPool.
+//
+// The queue is a lock-free multi-producer single-consumer queue: any thread
+// may post, and the tasks are only ever taken off by the single drain() that
+// is scheduled on the pool.
+class WorkQueue {
+public:
+    WorkQueue(WorkerPool* pool_ptr);
+    ~WorkQueue();
+
+    void post(std::function<void()> task);
+
+private:
+    struct Node {
+        std::function<void()>  task;
+        std::atomic<Node*>     next;
+    };
+
+    void push(Node* node_ptr);
+    Node* pop();
+    void drain();
+
+private:
+    WorkerPool*          pool_ptr;
+    std::atomic<Node*>   head;       // last node pushed, by the producers
+    Node*                tail;       // next node to pop, by the consumer
+    Node                 stub;
+    std::atomic<size_t>  n_tasks;    // tasks posted and not yet finished
+};
+
+// The WorkerPool runs the tasks of all WorkQueues on a fixed number of threads.
+// Scheduling is round-robin over the queues: a queue runs at most 'quantum'
+// tasks before it has to go to the back of the line. A chatty session can
+// therefore not starve the other sessions.
+// The io_service of the WorkerPool can also be used as event loop for the
+// WebSocket connections, so that all work runs on the same fixed set of threads.
+class WorkerPool {
+public:
+    WorkerPool(size_t n_threads, size_t quantum = 1);
+    ~WorkerPool();
+
+    WorkQueue* create_queue();
+
+    void run();
+    void stop();
+    void join();
+
+    size_t get_thread_count();
+    size_t get_quantum();
+    boost::asio::io_service& get_io_service();
+
+private:
+    boost::asio::io_service        io_service;
+    boost::asio::io_service::work* work_ptr;
+    std::vector<std::thread>       threads;
+    std::vector<WorkQueue*>        queues;
+    std::mutex                     queues_mutex;
+
+    size_t                         n_threads;
+    size_t                         quantum;
+};
+
+#endif // WORKER_POOL_HPP